@@ -0,0 +1,231 @@
+#ifndef	_DEFAULT_SOURCE
+#define	_DEFAULT_SOURCE		/* strdup */
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "libpdp8.h"
+
+/*
+   Batch mode: pdp8 --batch <jobs> [-j <threads>] [-o <results>]
+
+   Each line of the jobs file describes a job:
+
+	<image> <input> <budget> [<start>]
+
+   The image is loaded into a new machine, which runs from start
+   (octal, 0200 by default) until HLT or for budget instructions,
+   with its keyboard reading the input file ("-" for none). Empty
+   lines and lines starting with '#' are ignored.
+
+   The jobs are shared by a pool of worker threads, each running one
+   machine at a time. When all are done, the teleprinter output and
+   the final state of every job are written to the results file
+   (stdout by default), in the order of the jobs file:
+
+	[<line>] <image>: HALT|BUDGET|ERROR after <n> instructions  PC=..  L=.  AC=....
+	<output>
+*/
+
+#define	BATCH_LINE	512
+
+typedef struct {
+	int line;				/* Line in the jobs file */
+	char *image;
+	char *input;
+	unsigned long budget;
+	unsigned start;
+
+	FILE *inp;				/* Keyboard input */
+	char *out;				/* Teleprinter output */
+	size_t outlen;
+	size_t outsize;
+
+	const char *error;		/* Results */
+	int halted;
+	unsigned long count;
+	unsigned pc, l, ac;
+} JOB;
+
+static JOB *jobs;
+static int njobs;
+static int next_job;		/* Next job to be run */
+static size_t batch_kwords;
+static const char *batch_engine;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;	/* next_job */
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;	/* pdp8_load() */
+
+/* Keyboard callback */
+static int job_input(void *ctx)
+{
+	JOB *job = ctx;
+	int ch;
+
+	if (!job->inp || (ch = fgetc(job->inp)) == EOF)
+		return -1;
+	return ch;
+}
+
+/* Teleprinter callback */
+static void job_output(void *ctx, int ch)
+{
+	JOB *job = ctx;
+
+	if (job->outlen == job->outsize) {
+		job->outsize = job->outsize ? job->outsize * 2 : 256;
+		job->out = realloc(job->out, job->outsize);
+	}
+	job->out[job->outlen++] = ch;
+}
+
+static void job_run(JOB *job)
+{
+	PDP8 *m;
+	int rc = -1;
+
+	if (strcmp(job->input, "-") && !(job->inp = fopen(job->input, "r"))) {
+		job->error = "cannot open the input";
+		return;
+	}
+
+	pthread_mutex_lock(&load_lock);
+	if ((m = pdp8_create(batch_kwords))) {
+		pdp8_engine(m, batch_engine);
+		rc = pdp8_load(m, job->image);
+	}
+	pthread_mutex_unlock(&load_lock);
+
+	if (!m)
+		job->error = "out of memory";
+	else if (rc)
+		job->error = "cannot load the image";
+	else {
+		pdp8_attach_input(m, 003, job_input, job);
+		pdp8_attach_output(m, 004, job_output, job);
+		pdp8_set(m, PDP8_PC, job->start);
+		job->count = pdp8_step(m, job->budget);
+		job->halted = pdp8_halted(m);
+		job->pc = pdp8_get(m, PDP8_PC);
+		job->l = pdp8_get(m, PDP8_L);
+		job->ac = pdp8_get(m, PDP8_AC);
+	}
+
+	if (m)
+		pdp8_destroy(m);
+	if (job->inp)
+		fclose(job->inp);
+}
+
+static void *worker(void *arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		i = next_job++;
+		pthread_mutex_unlock(&job_lock);
+		if (i >= njobs)
+			return 0;
+		job_run(&jobs[i]);
+	}
+}
+
+/* Read the jobs file. Return the # of jobs or -1 */
+static int read_jobs(const char *fname)
+{
+	FILE *fp;
+	char line[BATCH_LINE];
+	char image[BATCH_LINE], input[BATCH_LINE];
+	unsigned long budget;
+	unsigned start;
+	int nline = 0;
+	int n;
+	JOB *job;
+
+	if (!(fp = fopen(fname, "r"))) {
+		fprintf(stderr, "Could not open '%s'\n", fname);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		++nline;
+		start = 0200;
+		n = sscanf(line, "%s %s %lu %o", image, input, &budget, &start);
+		if (n < 1 || image[0] == '#')
+			continue;
+		if (n < 3 || !budget) {
+			fprintf(stderr, "%s:%d: expected <image> <input> <budget> [<start>]\n",
+				fname, nline);
+			fclose(fp);
+			return -1;
+		}
+		jobs = realloc(jobs, (njobs + 1) * sizeof(JOB));
+		job = &jobs[njobs++];
+		memset(job, 0, sizeof(JOB));
+		job->line = nline;
+		job->image = strdup(image);
+		job->input = strdup(input);
+		job->budget = budget;
+		job->start = start;
+	}
+
+	fclose(fp);
+	return njobs;
+}
+
+static void write_results(FILE *out)
+{
+	JOB *job;
+
+	for (job = jobs; job < jobs + njobs; ++job) {
+		fprintf(out, "[%d] %s: ", job->line, job->image);
+		if (job->error) {
+			fprintf(out, "ERROR %s\n\n", job->error);
+			continue;
+		}
+		fprintf(out, "%s after %lu instructions  PC=%05o  L=%o  AC=%04o\n",
+			job->halted ? "HALT" : "BUDGET", job->count, job->pc, job->l, job->ac);
+		fwrite(job->out, 1, job->outlen, out);
+		if (job->outlen && job->out[job->outlen - 1] != '\n')
+			fputc('\n', out);
+		fputc('\n', out);
+	}
+}
+
+/* Run the jobs in fname with nthreads workers. Return the exit code */
+int batch(const char *fname, int nthreads, const char *results,
+	size_t kwords, const char *engine)
+{
+	pthread_t *threads;
+	FILE *out = stdout;
+	int i;
+
+	if (read_jobs(fname) < 0)
+		return 1;
+	if (results && !(out = fopen(results, "w"))) {
+		fprintf(stderr, "Could not open '%s' for output\n", results);
+		return 1;
+	}
+
+	batch_kwords = kwords;
+	batch_engine = engine;
+	if (nthreads > njobs)
+		nthreads = njobs;
+	threads = calloc(nthreads, sizeof(pthread_t));
+	for (i = 0; i < nthreads; ++i)
+		pthread_create(&threads[i], 0, worker, 0);
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], 0);
+	free(threads);
+
+	write_results(out);
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
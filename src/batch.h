@@ -0,0 +1,8 @@
+#ifndef	_batch_h
+#define _batch_h
+
+/* Batch mode */
+extern int	batch(const char *fname, int nthreads, const char *results,
+				size_t kwords, const char *engine);
+
+#endif	/* _batch_h */
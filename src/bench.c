@@ -0,0 +1,275 @@
+#ifndef	_POSIX_C_SOURCE
+#define	_POSIX_C_SOURCE	199309L		/* clock_gettime */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libpdp8.h"
+
+/*
+   Instruction benchmark: make bench, or pdp8bench [<count>]
+
+   Each test is a short loop of instructions of one class, loaded at
+   0200 of a new machine and run for count instructions (10000000 by
+   default) with each execution engine. The result is the number of
+   simulated instructions per second, in millions. The loops end in a
+   JMP 0200 at least 8 words away, so they are never taken for idle
+   loops and every instruction is executed.
+
+   Page 0 holds the data and pointers used by the tests:
+
+	0020	0001		0023	0300 (pointer)
+	0021	7777		0024	0301 (pointer)
+	0022	0000
+*/
+
+#define	BENCH_COUNT	10000000UL
+#define	END			010000		/* End of a program */
+
+typedef struct {
+	const char *name;
+	unsigned kwords;		/* Memory needed */
+	const unsigned *code;	/* Loaded at 0200, up to END */
+} BENCH;
+
+static const unsigned direct[] = {
+	07300,		/* CLA CLL */
+	01020,		/* TAD 0020 */
+	00021,		/* AND 0021 */
+	01220,		/* TAD 0220 */
+	03022,		/* DCA 0022 */
+	01022,		/* TAD 0022 */
+	03222,		/* DCA 0222 */
+	01021,		/* TAD 0021 */
+	00220,		/* AND 0220 */
+	03022,		/* DCA 0022 */
+	05200,		/* JMP 0200 */
+	0, 0, 0, 0, 0,
+	00017,		/* 0220 */
+	0,
+	00000,		/* 0222 */
+	END
+};
+
+static const unsigned indirect[] = {
+	07300,		/* CLA CLL */
+	01423,		/* TAD I 0023 */
+	03424,		/* DCA I 0024 */
+	01621,		/* TAD I 0221 */
+	00423,		/* AND I 0023 */
+	03424,		/* DCA I 0024 */
+	01622,		/* TAD I 0222 */
+	03424,		/* DCA I 0024 */
+	05200,		/* JMP 0200 */
+	0, 0, 0, 0, 0, 0, 0, 0,
+	00300,		/* 0221 */
+	00301,		/* 0222 */
+	END
+};
+
+static const unsigned autoindex[] = {
+	07300,		/* CLA CLL */
+	01220,		/* TAD 0220 */
+	03010,		/* DCA 0010 */
+	01221,		/* TAD 0221 */
+	03011,		/* DCA 0011 */
+	01410,		/* TAD I 0010 */
+	03411,		/* DCA I 0011 */
+	01410,		/* TAD I 0010 */
+	03411,		/* DCA I 0011 */
+	01410,		/* TAD I 0010 */
+	03411,		/* DCA I 0011 */
+	01410,		/* TAD I 0010 */
+	03411,		/* DCA I 0011 */
+	05200,		/* JMP 0200 */
+	0, 0,
+	00777,		/* 0220: reads from 1000 */
+	01777,		/* 0221: writes to 2000 */
+	END
+};
+
+static const unsigned opr1[] = {
+	07300,		/* CLA CLL */
+	07001,		/* IAC */
+	07004,		/* RAL */
+	07010,		/* RAR */
+	07006,		/* RTL */
+	07012,		/* RTR */
+	07040,		/* CMA */
+	07020,		/* CML */
+	07041,		/* CIA */
+	07002,		/* BSW */
+	07100,		/* CLL */
+	05200,		/* JMP 0200 */
+	END
+};
+
+static const unsigned opr2[] = {
+	07300,		/* CLA CLL */
+	07500,		/* SMA */
+	07440,		/* SZA (skips) */
+	07000,		/* NOP */
+	07420,		/* SNL */
+	07510,		/* SPA (skips) */
+	07000,		/* NOP */
+	07450,		/* SNA */
+	07430,		/* SZL (skips) */
+	07000,		/* NOP */
+	07604,		/* LAS */
+	07410,		/* SKP */
+	07000,		/* NOP */
+	05200,		/* JMP 0200 */
+	END
+};
+
+static const unsigned eae[] = {
+	07300,		/* CLA CLL */
+	01220,		/* TAD 0220 */
+	07421,		/* MQL */
+	07405,		/* MUY */
+	00123,
+	07407,		/* DVI */
+	00007,
+	07413,		/* SHL */
+	00003,
+	07415,		/* ASR */
+	00002,
+	07417,		/* LSR */
+	00001,
+	07411,		/* NMI */
+	07441,		/* SCA */
+	05200,		/* JMP 0200 */
+	00017,		/* 0220 */
+	END
+};
+
+static const unsigned fields[] = {
+	06211,		/* CDF 10 */
+	01423,		/* TAD I 0023 (field 1) */
+	06201,		/* CDF 00 */
+	03424,		/* DCA I 0024 */
+	06202,		/* CIF 00 */
+	05206,		/* JMP .+1 */
+	06214,		/* RDF */
+	06224,		/* RIF */
+	07200,		/* CLA */
+	05200,		/* JMP 0200 */
+	END
+};
+
+static const unsigned iot[] = {
+	06031,		/* KSF */
+	06011,		/* RSF */
+	06021,		/* PSF */
+	06041,		/* TSF (skips) */
+	07000,		/* NOP */
+	06101,		/* SMP (skips) */
+	07000,		/* NOP */
+	06000,		/* SKON */
+	06003,		/* SRQ (skips) */
+	07000,		/* NOP */
+	05200,		/* JMP 0200 */
+	END
+};
+
+static const BENCH benches[] = {
+	{ "direct",		4,	direct		},
+	{ "indirect",	4,	indirect	},
+	{ "autoindex",	4,	autoindex	},
+	{ "opr1",		4,	opr1		},
+	{ "opr2",		4,	opr2		},
+	{ "eae",		4,	eae			},
+	{ "fields",		8,	fields		},
+	{ "iot",		4,	iot			},
+};
+
+static const char *const engines[] = { "decoded", "threaded", "block", "jit" };
+
+#define	NBENCHES	(sizeof(benches) / sizeof(benches[0]))
+#define	NENGINES	(sizeof(engines) / sizeof(engines[0]))
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+   Run b for count instructions with engine. Return millions of
+   instructions per second, 0 if the engine is not available or -1
+   if the test failed.
+*/
+static double run(const BENCH *b, const char *engine, unsigned long count)
+{
+	PDP8 *m;
+	unsigned a;
+	unsigned long n;
+	double t;
+
+	if (!(m = pdp8_create(b->kwords)))
+		return -1;
+	if (pdp8_engine(m, engine)) {
+		pdp8_destroy(m);
+		return 0;
+	}
+
+	pdp8_write(m, 0020, 00001);
+	pdp8_write(m, 0021, 07777);
+	pdp8_write(m, 0022, 00000);
+	pdp8_write(m, 0023, 00300);
+	pdp8_write(m, 0024, 00301);
+	for (a = 0; b->code[a] != END; ++a)
+		pdp8_write(m, 0200 + a, b->code[a]);
+	pdp8_set(m, PDP8_PC, 0200);
+
+	t = now();
+	n = pdp8_step(m, count);
+	t = now() - t;
+
+	pdp8_destroy(m);
+	if (n != count || t <= 0)
+		return -1;
+	return n / t / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = BENCH_COUNT;
+	unsigned i, j;
+	double r;
+	int rc = 0;
+
+	if (argc > 2 || (argc == 2 && !(count = strtoul(argv[1], 0, 10)))) {
+		fprintf(stderr, "Usage: %s [<count>]\n", argv[0]);
+		return 1;
+	}
+
+	printf("Millions of instructions per second, %lu instructions per test\n\n", count);
+	printf("%-10s", "Test");
+	for (j = 0; j < NENGINES; ++j)
+		printf("%10s", engines[j]);
+	printf("\n");
+
+	for (i = 0; i < NBENCHES; ++i) {
+		printf("%-10s", benches[i].name);
+		fflush(stdout);
+		for (j = 0; j < NENGINES; ++j) {
+			r = run(&benches[i], engines[j], count);
+			if (r < 0) {
+				printf("%10s", "FAILED");
+				rc = 1;
+			} else if (!r)
+				printf("%10s", "-");
+			else
+				printf("%10.1f", r);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	return rc;
+}
@@ -0,0 +1,225 @@
+#ifndef	_POSIX_C_SOURCE
+#define	_POSIX_C_SOURCE	199309L		/* clock_gettime */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "libpdp8.h"
+
+/*
+   FOCAL benchmark: make bench-focal [FOCAL=<image>], or
+   pdp8focal [-e <engine>] <focal image> <program> [<fuel rate>...]
+
+   Loads a FOCAL image, answers its startup dialogue, types the
+   program in line by line, starts it with GO and answers every K=
+   with the next fuel rate (the last one once they run out), all
+   through the keyboard, until FOCAL prompts again after the program
+   has ended. It then reports the wall time, the instructions executed
+   and the host I/O syscalls (from /proc/self/io) and context switches.
+   The teleprinter output is written to bench-focal.out.
+
+   The input is typed as a person would: each line only after FOCAL
+   has asked for it, recognized by the end of its output:
+
+	?:		a question of the dialogue, answered NO
+	*		the prompt, for the next line of the program, then GO
+	K=		the lunar lander asking for a fuel rate
+*/
+
+#define	FOCAL_STEP		100000UL		/* Instructions between checks */
+#define	FOCAL_BUDGET	4000000000ULL	/* Give up after so many */
+#define	FOCAL_OUT		"bench-focal.out"
+#define	FOCAL_LINE		256
+
+static const char *const default_rates[] = {
+	"0", "0", "0", "0", "0", "0", "0", "170", "200", "200", "200", "200",
+	"170", "150", "120", "100", "80", "60", "40", "20", "10", "8"
+};
+
+typedef struct {
+	FILE *prog;				/* Program being typed in (0=done) */
+	const char *const *rates;
+	int nrates;
+	int rate;				/* Next one */
+	int started;			/* GO typed */
+	int done;				/* Prompted after the program ended */
+
+	char line[FOCAL_LINE];	/* Being typed */
+	size_t pos;
+
+	char tail[4];			/* End of the output since the last line */
+	FILE *out;
+	unsigned long chars;	/* Printed */
+} FOCAL;
+
+/* Return 1 if the output since the last line typed ends with s */
+static int ends_with(FOCAL *f, const char *s)
+{
+	size_t n = strlen(s);
+
+	return !memcmp(f->tail + sizeof(f->tail) - n, s, n);
+}
+
+/* Get the next line to type into f->line, if FOCAL is asking for one */
+static void next_line(FOCAL *f)
+{
+	char buf[FOCAL_LINE - 2];	/* Room for the CR */
+
+	if (ends_with(f, "?:"))
+		strcpy(f->line, "NO\r");
+	else if (ends_with(f, "K=")) {
+		sprintf(f->line, "%s\r", f->rates[f->rate]);
+		if (f->rate < f->nrates - 1)
+			++f->rate;
+	} else if (!ends_with(f, "*"))
+		return;
+	else {
+		f->line[0] = 0;
+		while (f->prog && !f->line[0]) {
+			if (!fgets(buf, sizeof(buf), f->prog)) {
+				fclose(f->prog);
+				f->prog = 0;
+				break;
+			}
+			buf[strcspn(buf, "\r\n")] = 0;
+			if (buf[0])		/* Skip empty lines */
+				sprintf(f->line, "%s\r", buf);
+		}
+		if (!f->line[0]) {
+			if (f->started) {
+				f->done = 1;
+				return;
+			}
+			strcpy(f->line, "GO\r");
+			f->started = 1;
+		}
+	}
+	f->pos = 0;
+	memset(f->tail, 0, sizeof(f->tail));
+}
+
+/* Keyboard callback */
+static int focal_input(void *ctx)
+{
+	FOCAL *f = ctx;
+
+	if (!f->line[f->pos]) {
+		f->line[0] = f->pos = 0;
+		next_line(f);
+		if (!f->line[0])
+			return -1;
+	}
+	return (unsigned char)f->line[f->pos++];
+}
+
+/* Teleprinter callback */
+static void focal_output(void *ctx, int ch)
+{
+	FOCAL *f = ctx;
+
+	ch &= 0177;
+	putc(ch, f->out);
+	++f->chars;
+	if (ch == '\n' || ch == '\r' || !ch)	/* Not part of a prompt */
+		return;
+	memmove(f->tail, f->tail + 1, sizeof(f->tail) - 1);
+	f->tail[sizeof(f->tail) - 1] = ch;
+}
+
+/* Read the I/O syscalls made so far from /proc/self/io, 0 if unknown */
+static unsigned long long syscalls(void)
+{
+	FILE *fp;
+	char buf[80];
+	unsigned long long n, total = 0;
+
+	if (!(fp = fopen("/proc/self/io", "r")))
+		return 0;
+	while (fgets(buf, sizeof(buf), fp))
+		if (sscanf(buf, "syscr: %llu", &n) == 1 || sscanf(buf, "syscw: %llu", &n) == 1)
+			total += n;
+	fclose(fp);
+	return total;
+}
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *engine = "jit";
+	unsigned long long count = 0, sys0, sys1;
+	struct rusage ru;
+	FOCAL f;
+	PDP8 *m;
+	double t;
+	int i = 1;
+
+	if (argc > 2 && !strcmp(argv[1], "-e")) {
+		engine = argv[2];
+		i = 3;
+	}
+	if (argc - i < 2) {
+		fprintf(stderr, "Usage: %s [-e <engine>] <focal image> <program> [<fuel rate>...]\n",
+			argv[0]);
+		return 1;
+	}
+
+	memset(&f, 0, sizeof(f));
+	if (!(m = pdp8_create(4)) || pdp8_engine(m, engine) < 0) {
+		fprintf(stderr, "Could not create a machine with engine %s\n", engine);
+		return 1;
+	}
+	if (pdp8_load(m, argv[i])) {
+		fprintf(stderr, "Could not load the FOCAL image '%s'\n", argv[i]);
+		return 1;
+	}
+	if (!(f.prog = fopen(argv[i + 1], "r"))) {
+		fprintf(stderr, "Could not open the program '%s'\n", argv[i + 1]);
+		return 1;
+	}
+	if (!(f.out = fopen(FOCAL_OUT, "w"))) {
+		fprintf(stderr, "Could not open '%s' for output\n", FOCAL_OUT);
+		return 1;
+	}
+	if (argc - i > 2) {
+		f.rates = (const char *const *)argv + i + 2;
+		f.nrates = argc - i - 2;
+	} else {
+		f.rates = default_rates;
+		f.nrates = sizeof(default_rates) / sizeof(default_rates[0]);
+	}
+
+	pdp8_attach_input(m, 003, focal_input, &f);
+	pdp8_attach_output(m, 004, focal_output, &f);
+	pdp8_set(m, PDP8_PC, 0200);
+
+	sys0 = syscalls();
+	t = now();
+	while (!f.done && !pdp8_halted(m) && count < FOCAL_BUDGET)
+		count += pdp8_step(m, FOCAL_STEP);
+	t = now() - t;
+	sys1 = syscalls();
+	getrusage(RUSAGE_SELF, &ru);
+	fclose(f.out);
+
+	printf("FOCAL %s, %s, engine %s\n", argv[i], argv[i + 1], engine);
+	printf("%s after %llu instructions\n",
+		f.done ? "Done" : pdp8_halted(m) ? "HALTED" : "DID NOT FINISH", count);
+	printf("Wall time:     %.3f s (%.1f million instructions per second)\n",
+		t, t > 0 ? count / t / 1e6 : 0.0);
+	printf("Printed:       %lu characters (see %s)\n", f.chars, FOCAL_OUT);
+	printf("I/O syscalls:  %llu\n", sys1 - sys0);
+	printf("Context switches: %ld voluntary, %ld involuntary\n", ru.ru_nvcsw, ru.ru_nivcsw);
+
+	pdp8_destroy(m);
+	return f.done ? 0 : 1;
+}
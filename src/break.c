@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdp8.h"
+
+/*
+   Breakpoints
+
+   A breakpoint stops the CPU right before the instruction at its
+   address is executed, if its conditions on AC, L and DF hold, once
+   it has been reached skip times with them holding. Memory is never
+   changed: the words with breakpoints are tagged T_BREAK, and while
+   there are any, cpu_attention() is called after every instruction
+   and calls brk_stop() when the next one is tagged. With no
+   breakpoints, nothing is checked at all.
+
+   Breakpoint n (from 1, as long as it is set) is bp_table[n - 1].
+   The table grows as needed, so there's no limit on their number.
+*/
+#define	bp_table	(M->bp_table)
+#define	bp_slots	(M->bp_slots)
+
+#define	BRK_SLOTS	16	/* Initial size of bp_table */
+
+/* Set breakpoint *b (its hits are cleared). Return its number, 0 if out of memory */
+int brk_set(const BREAK *b)
+{
+	BREAK *t;
+	int n, slots;
+
+	for (n = 0; n < bp_slots && bp_table[n].used; ++n)
+		;
+	if (n == bp_slots) {	/* Full */
+		slots = bp_slots ? 2 * bp_slots : BRK_SLOTS;
+		if (!(t = realloc(bp_table, slots * sizeof(BREAK))))
+			return 0;
+		memset(t + bp_slots, 0, (slots - bp_slots) * sizeof(BREAK));
+		bp_table = t;
+		bp_slots = slots;
+	}
+
+	bp_table[n] = *b;
+	bp_table[n].used = 1;
+	bp_table[n].hits = 0;
+	MT[b->addr] |= T_BREAK;
+	++BP_COUNT;
+	return n + 1;
+}
+
+/* Return breakpoint n, or 0 if it isn't set */
+BREAK *brk_get(int n)
+{
+	if (n < 1 || n > bp_slots || !bp_table[n - 1].used)
+		return 0;
+	return &bp_table[n - 1];
+}
+
+/* Return the number of the first breakpoint at addr, 0 if none */
+int brk_at(WORD addr)
+{
+	int n;
+
+	if (!(MT[addr] & T_BREAK))
+		return 0;
+	for (n = 0; n < bp_slots; ++n)
+		if (bp_table[n].used && bp_table[n].addr == addr)
+			return n + 1;
+	return 0;
+}
+
+/* Clear breakpoint n. Return 0 if done, -1 if it isn't set */
+int brk_clear(int n)
+{
+	BREAK *b;
+	WORD addr;
+
+	if (!(b = brk_get(n)))
+		return -1;
+	addr = b->addr;
+	b->used = 0;
+	--BP_COUNT;
+	if (!brk_at(addr))
+		MT[addr] &= ~T_BREAK;
+	return 0;
+}
+
+/*
+   Called before the instruction at PC (tagged T_BREAK) is executed.
+   Count a hit for each breakpoint there whose conditions hold and
+   return the number of the first one to stop at, 0 to go on.
+*/
+int brk_stop(void)
+{
+	BREAK *b;
+	int n, stop = 0;
+
+	for (n = 1, b = bp_table; n <= bp_slots; ++n, ++b) {
+		if (!b->used || b->addr != PC)
+			continue;
+		if (((b->cond & BRK_AC) && AC != b->ac)
+			|| ((b->cond & BRK_L) && L != b->l)
+			|| ((b->cond & BRK_DF) && DF >> FIELD_SHFT != b->df))
+			continue;
+		if (++b->hits > b->skip && !stop)
+			stop = n;
+	}
+	return stop;
+}
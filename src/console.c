@@ -3,7 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
-#include <assert.h>
 
 #include "pdp8.h"
 #include "console.h"
@@ -16,30 +15,48 @@ extern void inline_asm(WORD addr);
 #define MAXARGS	10
 
 static int  assign(int argc, char *argv[]);
-static int  bp_check(WORD addr);
 static int  bp_clear(int argc, char *argv[]);
+static int  bp_cond(const char *arg, const char *name, int base, unsigned long max, unsigned long *v);
 static int  bp_list(int argc, char *argv[]);
 static int  bp_set(int argc, char *argv[]);
 static void con_trace_next(WORD addr, WORD code);
 static int  cont(int argc, char *argv[]);
 static int  deposit(int argc, char *argv[]);
 static int  examine(int argc, char *argv[]);
+static int  fork_list(int argc, char *argv[]);
+static void fork_reap(int wait);
+static int  fork_start(int argc, char *argv[]);
 static int  help(int argc, char *argv[]);
+static int  history(int argc, char *argv[]);
 static int  load(int argc, char *argv[]);
 static int  make_argv(char *line, char **argv);
 static int  octal_args(int argc, char *argv[], WORD args[], int minargs, int maxargs);
 //static void print_argv(int argc, char *argv[]);
 static int  quit(int argc, char *argv[]);
+static int  rate(int argc, char *argv[]);
+static int  restore(int argc, char *argv[]);
+static int  rev_cont(int argc, char *argv[]);
+static int  rev_step(int argc, char *argv[]);
+static int  reverse(int argc, char *argv[]);
 static int  run(int argc, char *argv[]);
+static void run_stopped(void);
+static int  save(int argc, char *argv[]);
 static int  set_acc(int argc, char *argv[]);
 static int  set_link(int argc, char *argv[]);
 static int  set_log(int argc, char *argv[]);
+static int  set_profile(int argc, char *argv[]);
+static int  set_stats(int argc, char *argv[]);
+static void show_stats(void);
 static void set_signals(void);
 static int  set_swt(int argc, char *argv[]);
 static int  set_trace(int argc, char *argv[]);
 static int  show_regs(int argc, char *argv[]);
 static int  single_step(int argc, char *argv[]);
 static void sig_handler(int sig);
+static int  trace_bin(int argc, char *argv[]);
+static int  wp_clear(int argc, char *argv[]);
+static int  wp_list(int argc, char *argv[]);
+static int  wp_set(int argc, char *argv[]);
 
 typedef struct {
 	char *name;						/* Command name	*/
@@ -52,21 +69,35 @@ Command cmdtable[] = {
 	{ "assign",	"<dev> <file>",			"Assign file to device",assign		},
 	{ "bc",		"<bp #>",				"Clear breakpoint",		bp_clear	},
 	{ "bl",		"",						"List breakpoints",		bp_list		},
-	{ "bp",		"<addr>",				"Set breakpoint",		bp_set		},
+	{ "bp",		"<addr> [<cond>...]",	"Set breakpoint",		bp_set		},
 	{ "continue","",					"Continue",				cont		},
 	{ "deposit","<addr>",				"Deposit memory",		deposit		},
 	{ "examine","<addr> [<count>]",		"Examine memory", 		examine,	},
+	{ "fork",	"[<sr> [<file>]]",		"Run a clone",			fork_start,	},
+	{ "forks",	"",						"List running clones",	fork_list,	},
 	{ "help",	"",						"Display help",			help,		},
+	{ "history","[<n>|size <n>]",		"Show last instructions",history,	},
 	{ "load",	"<file>",				"Load file",			load,		},
 	{ "log",    "0|1",                  "Start/stop logging",	set_log,	},
+	{ "profile","on|off|report [<n>]",	"Profile execution",	set_profile,},
 	{ "quit",	"",						"Quit simulator",		quit,		},
+	{ "rate",	"[max|asr33|highspeed]","Set device rate",		rate,		},
+	{ "rcontinue","",					"Continue backwards",	rev_cont,	},
+	{ "restore","<file>",				"Restore snapshot",		restore,	},
+	{ "reverse","[on [<n>]|off]",		"Reverse execution",	reverse,	},
+	{ "rstep",	"[<n>]",				"Step backwards",		rev_step,	},
 	{ "run",	"<addr>",				"Run program",			run,		},
+	{ "save",	"<file>",				"Save snapshot",		save,		},
 	{ "sacc",	"<value>",				"Set ACC=value",		set_acc,	},
 	{ "shregs",	"",						"Show registers",		show_regs,	},
 	{ "si",		"",						"Single step",			single_step	},
 	{ "slink",	"0|1",					"Set L=0|1",			set_link,	},
 	{ "sswt",	"<value>",				"Set SR=value",			set_swt,	},
-	{ "trace",	"0|1 [<file>]",			"Start/stop tracing",	set_trace,	},
+	{ "stats",	"[on|off|clear]",		"Instruction mix",		set_stats,	},
+	{ "trace",	"0|1|bin [<file>] [<n>]","Start/stop tracing",	set_trace,	},
+	{ "watch",	"<addr> [<mode>...]",	"Set watchpoint",		wp_set,		},
+	{ "wc",		"<watch #>",			"Clear watchpoint",		wp_clear,	},
+	{ "wl",		"",						"List watchpoints",		wp_list,	},
 	{ "?",		"",						"Display help",			help,		},
 	{	0,		0,						0,						0,			}
 };
@@ -76,15 +107,16 @@ static Command *find_command(char *name);
 static FILE *tracef;	/* Trace file pointer */
 static size_t traceb;	/* # of bytes used by trace file */
 
-#define	MAXBREAKPOINTS	10
+#define	MAXFORKS	10
 
 typedef struct {
-	WORD	addr;		// Address of breakpoint
-	WORD	inst;		// Original instruction
-} BreakPoint;
+	PDP8_CLONE *clone;	// Running clone (0=free slot)
+	WORD pc;			// Where it started
+	WORD sr;			// Its switch register
+	FILE *out;			// Its teleprinter output (0=none)
+} Fork;
 
-BreakPoint bptable[MAXBREAKPOINTS];
-int nBreakPoints;
+Fork forktable[MAXFORKS];
 
 void console(void)
 {
@@ -95,17 +127,21 @@ void console(void)
 
 	set_signals();
 	tty_init();
+	M->on_trace = con_trace;
+	M->on_stop = con_stop;
+	M->on_watch = con_watch;
 
 	printf("\nVirtual console\n");
 
 	while (1) {
+		fork_reap(0);	/* Report the clones that are done */
 		printf("\nPC=%05o> ",PC);
 		if (fgets(line, sizeof(line), stdin) == NULL) {
 			if (STOP) {	/* Ignore CTRL-C in the main loop */
 				STOP = 0;
 				continue;
 			}
-			return;	/* EOF */
+			break;	/* EOF */
 		}
 
 		if ((argc = make_argv(line, argv)) < 1)
@@ -128,6 +164,9 @@ void console(void)
 		if ((*pcm->handler)(argc, argv))
 			break;		/* Quit command */
 	}
+
+	fork_reap(-1);	/* Don't leave clones running */
+	show_stats();	/* If there are any */
 }
 
 /* Show last instruction that was executed + current state */
@@ -181,6 +220,13 @@ void con_stop(void)
 		printf("\n\nINTERRUPT @ %05o  L=%d  AC=%04o\n",PC-1,L,AC);
 }
 
+/* Report an access caught by a logging watchpoint */
+void con_watch(int n, WORD addr, int write)
+{
+	printf("Watch %o: %s %05o [%04o] @ %05o\r\n",
+		n, write ? "write" : "read", addr, MP[addr], THISPC);
+}
+
 static Command *find_command(char *name)
 {
 	char *ptab, *pname;
@@ -336,7 +382,8 @@ static void set_signals(void)
 
 static void sig_handler(int sig)
 {
-	if (sig == SIGINT) STOP = 1;
+	if (sig == SIGINT)
+		STOP = 1;	/* Seen by the next cpu_attention() */
 }
 
 // bc <bp #>
@@ -344,29 +391,16 @@ static int bp_clear(int argc, char *argv[])
 {
 	WORD args[MAXARGS+1];
 	int bn;
-	BreakPoint *bp;
 
 	if (octal_args(argc, argv, args, 1, 1) < 0)
 		return 0;
 
 	bn = args[1];
 
-	if (bn < 1 || bn > MAXBREAKPOINTS) {
-		printf("Valid breakpoint numbers are between 1 and %o\n", MAXBREAKPOINTS);
-		return 0;
-	}
-	bp = &bptable[bn-1];
-
-	if (!bp->addr) {
+	if (brk_clear(bn)) {
 		printf("Breakpoint %o does not exist\n", bn);
 		return 0;
 	}
-
-	// Restore original instruction
-	MP[bp->addr] = bp->inst;
-	// Mark slot as free
-	bp->addr = 0;
-	--nBreakPoints;
 	if (bn == BP_NUM)
 		BP_NUM = 0;
 
@@ -378,109 +412,206 @@ static int bp_clear(int argc, char *argv[])
 static int bp_list(UNUSED int argc, UNUSED char *argv[])
 {
 	int bn;
-	BreakPoint *bp;
+	BREAK *bp;
 
-	if (!nBreakPoints) {
+	if (!BP_COUNT) {
 		printf("There are no breakpoints\n");
 		return 0;
 	}
 
 	printf("\n");
-	printf(" #   Addr  Inst\n");
-	printf("--  -----  ----\n");
-	for (bn = 1, bp = bptable; bn <= MAXBREAKPOINTS; ++bn, ++bp) {
-		if (bp->addr)
-			printf("%2o  %05o  %04o\n", bn, bp->addr, bp->inst);
+	printf(" #   Addr  Inst        Hits  Condition\n");
+	printf("--  -----  ----  ----------  ---------\n");
+	for (bn = 1; bn <= M->bp_slots; ++bn) {
+		if (!(bp = brk_get(bn)))
+			continue;
+		printf("%2o  %05o  %04o  %10lu ", bn, bp->addr, MP[bp->addr], bp->hits);
+		if (bp->cond & BRK_AC)
+			printf(" ac=%04o", bp->ac);
+		if (bp->cond & BRK_L)
+			printf(" l=%o", bp->l);
+		if (bp->cond & BRK_DF)
+			printf(" df=%o", bp->df);
+		if (bp->skip)
+			printf(" skip=%lu", bp->skip);
+		printf("\n");
 	}
 
 	return 0;
 }
 
-// bp <addr>
+/* If arg is "<name><value>" with value <= max in base, store it in *v. Return 1 if so */
+static int bp_cond(const char *arg, const char *name, int base, unsigned long max, unsigned long *v)
+{
+	size_t n = strlen(name);
+	char *end;
+
+	if (strncmp(arg, name, n) || !arg[n])
+		return 0;
+	*v = strtoul(arg + n, &end, base);
+	return !*end && *v <= max;
+}
+
+/*
+   bp <addr> [ac=<value>] [l=<value>] [df=<field>] [skip=<n>]
+
+   Stops before the instruction at addr is executed, only when AC, L
+   and DF have these values (octal), once skip (decimal) such hits
+   have gone by. Memory isn't changed (see break.c).
+*/
 static int bp_set(int argc, char *argv[])
 {
 	WORD args[MAXARGS+1];
-	int bn;
-	BreakPoint *bp;
+	unsigned long v;
+	BREAK b;
+	int i, bn;
 
-	if (octal_args(argc, argv, args, 1, 1) < 0)
+	if (octal_args(argc < 2 ? argc : 2, argv, args, 1, 1) < 0)
 		return 0;
 
-	if (nBreakPoints == MAXBREAKPOINTS) {
-		printf("Maximum of %d breakpoints allowed\n", MAXBREAKPOINTS);
+	memset(&b, 0, sizeof(b));
+	b.addr = args[1];
+	for (i = 2; i < argc; ++i) {
+		if (bp_cond(argv[i], "ac=", 8, WORD_MASK, &v)) {
+			b.cond |= BRK_AC;
+			b.ac = v;
+		} else if (bp_cond(argv[i], "l=", 8, 1, &v)) {
+			b.cond |= BRK_L;
+			b.l = v;
+		} else if (bp_cond(argv[i], "df=", 8, 7, &v)) {
+			b.cond |= BRK_DF;
+			b.df = v;
+		} else if (!bp_cond(argv[i], "skip=", 10, ~0UL, &b.skip)) {
+			printf("Invalid condition: %s (ac=<value> l=<0|1> df=<field> skip=<n>)\n", argv[i]);
+			return 0;
+		}
+	}
+
+	if (!(bn = brk_set(&b))) {
+		printf("Out of memory\n");
 		return 0;
 	}
 
-	WORD addr = args[1];
+	printf("Breakpoint %o set at %05o\n", bn, b.addr);
+	return 0;
+}
+
+// wc <watch #>
+static int wp_clear(int argc, char *argv[])
+{
+	WORD args[MAXARGS+1];
+	int wn;
 
-	if (!addr) {
-		printf("Cannot set breakpoint at address 0\n");
+	if (octal_args(argc, argv, args, 1, 1) < 0)
 		return 0;
-	}
 
-	// Make sure a breakpoint does not already exist at this address
-	if (bp_check(addr)) {
-		printf("Breakpoint already exists at %05o\n", addr);
+	wn = args[1];
+
+	if (watch_clear(wn)) {
+		printf("Watchpoint %o does not exist\n", wn);
 		return 0;
 	}
+	if (wn == WATCH_NUM)
+		WATCH_NUM = 0;
 
-	// Find free breakpoint slot
-	for (bn = 1, bp = bptable; bn <= MAXBREAKPOINTS; ++bn, ++bp) {
-		// Zero addr means slot is free
-		if (!bp->addr)
-			break;	// found
-	}
+	printf("Watchpoint %o cleared\n", wn);
+	return 0;
+}
 
-	assert(bn <= MAXBREAKPOINTS);
+// wl
+static int wp_list(UNUSED int argc, UNUSED char *argv[])
+{
+	int wn;
+	WATCH *wp;
 
-	bp->addr = addr;
-	bp->inst = MP[addr];
-	MP[addr] = HALT;
-	++nBreakPoints;
+	if (!WATCH_COUNT) {
+		printf("There are no watchpoints\n");
+		return 0;
+	}
+
+	printf("\n");
+	printf(" #   Addr  Words  Mode        Hits\n");
+	printf("--  -----  -----  ------  ----------\n");
+	for (wn = 1; wn <= M->watch_slots; ++wn) {
+		if (!(wp = watch_get(wn)))
+			continue;
+		printf("%2o  %05o  %5o  %-2s%4s  %10lu\n", wn, wp->addr, wp->len,
+			wp->mode & WATCH_R ? (wp->mode & WATCH_W ? "rw" : "r") : "w",
+			wp->mode & WATCH_LOG ? " log" : "", wp->hits);
+	}
 
-	printf("Breakpoint %o set at %05o\n", bn, addr);
 	return 0;
 }
 
-// If there's a breakpoint at addr, return its number
-// Otherwise return 0
-static int bp_check(WORD addr)
+/*
+   watch <addr> [r|w|rw] [<n>] [log]
+
+   Stops right after an instruction that reads or writes (w by
+   default) one of the n words (octal, 1 by default) from addr, or
+   only reports it with log (see watch.c).
+*/
+static int wp_set(int argc, char *argv[])
 {
-	int bn;
-	int nb;
-	BreakPoint *bp;
-
-	bn = 1;
-	bp = bptable;
-	nb = nBreakPoints;	// Only check this many breakpoints
-
-	while (nb && bn <= MAXBREAKPOINTS) {
-		if (bp->addr) {	// Valid slot?
-			if (bp->addr == addr)
-				return bn;	// Found a breakpoint at addr
-			--nb;
+	WORD args[MAXARGS+1];
+	WATCH w;
+	char *end;
+	int i, wn;
+
+	if (octal_args(argc < 2 ? argc : 2, argv, args, 1, 1) < 0)
+		return 0;
+
+	memset(&w, 0, sizeof(w));
+	w.addr = args[1];
+	w.len = 1;
+	w.mode = WATCH_W;
+	for (i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "r"))
+			w.mode = (w.mode & WATCH_LOG) | WATCH_R;
+		else if (!strcmp(argv[i], "w"))
+			w.mode = (w.mode & WATCH_LOG) | WATCH_W;
+		else if (!strcmp(argv[i], "rw"))
+			w.mode = (w.mode & WATCH_LOG) | WATCH_R | WATCH_W;
+		else if (!strcmp(argv[i], "log"))
+			w.mode |= WATCH_LOG;
+		else if (!(w.len = strtoul(argv[i], &end, 8)) || *end || w.addr + w.len > memwords) {
+			printf("Invalid argument: %s (r|w|rw, <n> words, log)\n", argv[i]);
+			return 0;
 		}
-		++bn;
-		++bp;
 	}
 
-	return 0;	// No breakpoint found
+	if (!(wn = watch_set(&w))) {
+		printf("Out of memory\n");
+		return 0;
+	}
+
+	printf("Watchpoint %o set at %05o", wn, w.addr);
+	if (w.len > 1)
+		printf("-%05o", w.addr + w.len - 1);
+	printf("\n");
+	return 0;
+}
+
+/* Report why a run ended */
+static void run_stopped(void)
+{
+	if (RUN)
+		return;
+	if (WATCH_NUM) {
+		printf("\nWatch %o: %s %05o [%04o] @ %05o\n", WATCH_NUM,
+			M->watch_write ? "write" : "read", M->watch_addr, MP[M->watch_addr], THISPC);
+		con_trace_next(PC, MP[PC]);
+	} else if (BP_NUM) {
+		printf("\nBreakpoint %o @ %05o\n", BP_NUM, PC);
+		con_trace_next(PC, MP[PC]);
+	} else if (IR == HALT)
+		printf("\n\nHALT @ %05o  L=%d  AC=%04o\n",PC-1,L,AC);
 }
 
 /* continue */
 static int cont(UNUSED int argc, UNUSED char *argv[])
 {
 	cpu_run(PC, 0);
-
-	if (!RUN && (IR == HALT)) {
-		if ((BP_NUM = bp_check(PC-1))) {
-			--PC;
-			MP[PC] = bptable[BP_NUM-1].inst;	// Restore original instruction
-			printf("\nBreakpoint %o @ %05o\n", BP_NUM, PC);
-			con_trace_next(PC,MP[PC]);
-		} else
-			printf("\n\nHALT @ %05o  L=%d  AC=%04o\n",PC-1,L,AC);
-	}
+	run_stopped();
 
 	tty_exit();
 
@@ -534,10 +665,8 @@ static int examine(int argc, char *argv[])
 
 	while (count--) {
 		inst.addr = addr;
-		if ((bn = bp_check(addr)))		// Is there a breakpoint here?
-			inst.inst = bptable[bn-1].inst;	// Yes, show original instruction
-		else
-			inst.inst = MP[addr];			// No, show current instruction
+		inst.inst = MP[addr];
+		bn = brk_at(addr);		// Is there a breakpoint here?
 		cpu_disasm(&inst);
 		fprintf(out, "%05o:%s%s%04o  %s  %s%s%s\n",
 			addr,
@@ -554,6 +683,139 @@ static int examine(int argc, char *argv[])
 	return 0;
 }
 
+// Clone devices: no input, output to a file or nowhere
+static int fork_input(UNUSED void *ctx)
+{
+	return -1;
+}
+
+static void fork_output(void *ctx, int ch)
+{
+	if (ctx)
+		fputc(ch, (FILE *)ctx);
+}
+
+// Prepare a clone (runs in the child)
+static void fork_setup(PDP8 *clone, void *ctx)
+{
+	Fork *f = ctx;
+
+	pdp8_set(clone, PDP8_SR, f->sr);
+	pdp8_attach_input(clone, 003, fork_input, 0);
+	pdp8_attach_input(clone, 001, fork_input, 0);
+	pdp8_attach_output(clone, 004, fork_output, f->out);
+	pdp8_attach_output(clone, 002, fork_output, 0);
+}
+
+// fork [<sr> [<file>]]
+static int fork_start(int argc, char *argv[])
+{
+	WORD args[MAXARGS+1];
+	Fork *f;
+	int fn;
+
+	if (argc > 3) {
+		printf("fork [<sr> [<file>]]\n");
+		return 0;
+	}
+
+	if (octal_args(argc > 2 ? 2 : argc, argv, args, 0, 1) < 0)
+		return 0;
+
+	// Find free fork slot
+	for (fn = 1, f = forktable; fn <= MAXFORKS; ++fn, ++f)
+		if (!f->clone)
+			break;
+	if (fn > MAXFORKS) {
+		printf("Maximum of %d clones allowed\n", MAXFORKS);
+		return 0;
+	}
+
+	f->pc = PC;
+	f->sr = argc > 1 ? args[1] : SR;
+	f->out = 0;
+	if (argc > 2 && !(f->out = fopen(argv[2], "w"))) {
+		printf("Could not open '%s' for output\n", argv[2]);
+		return 0;
+	}
+
+	f->clone = pdp8_fork(M, 0, fork_setup, f);
+	if (f->out)
+		fclose(f->out);	// The clone has its own
+	if (!f->clone) {
+		printf("Could not fork\n");
+		return 0;
+	}
+
+	printf("Fork %o running from %05o  SR=%04o\n", fn, f->pc, f->sr);
+	return 0;
+}
+
+// Report the clones that are done, waiting for them if wait is 1
+// If wait is -1, stop them instead
+static void fork_reap(int wait)
+{
+	PDP8_STATUS st;
+	int fn;
+	int rc;
+	Fork *f;
+
+	for (fn = 1, f = forktable; fn <= MAXFORKS; ++fn, ++f) {
+		if (!f->clone)
+			continue;
+		if (wait < 0) {
+			pdp8_kill(f->clone);
+			f->clone = 0;
+			continue;
+		}
+		if (!(rc = pdp8_join(f->clone, wait, &st)))
+			continue;	// Still running
+		f->clone = 0;
+
+		printf("\nFork %o: ", fn);
+		if (rc < 0)
+			printf("FAILED\n");
+		else if (st.watchpoint)
+			printf("Watch %o before %05o  L=%d  AC=%04o", st.watchpoint, st.pc, st.l, st.ac);
+		else if (st.breakpoint)
+			printf("Breakpoint %o @ %05o  L=%d  AC=%04o", st.breakpoint, st.pc, st.l, st.ac);
+		else if (!st.halted)
+			printf("INTERRUPT @ %05o  L=%d  AC=%04o", st.pc - 1, st.l, st.ac);
+		else
+			printf("HALT @ %05o  L=%d  AC=%04o", st.pc - 1, st.l, st.ac);
+		if (rc > 0)
+			printf("  (%lu instructions)\n", st.count);
+	}
+}
+
+// forks
+static int fork_list(int argc, char *argv[])
+{
+	WORD args[MAXARGS+1];
+	int fn;
+	int n = 0;
+	Fork *f;
+
+	if (octal_args(argc, argv, args, 0, 0) < 0)
+		return 0;
+
+	fork_reap(0);
+	for (fn = 1, f = forktable; fn <= MAXFORKS; ++fn, ++f) {
+		if (!f->clone)
+			continue;
+		if (!n++) {
+			printf("\n");
+			printf(" #  Start    SR\n");
+			printf("--  -----  ----\n");
+		}
+		printf("%2o  %05o  %04o\n", fn, f->pc, f->sr);
+	}
+	if (!n)
+		printf("There are no clones running\n");
+
+	return 0;
+}
+
 static int help(int argc, char *argv[])
 {
 	Command *pcm;
@@ -595,11 +857,6 @@ static int help(int argc, char *argv[])
 	return 0;
 }
 
-#define	FILEFMT_ASM		1	// macro-8 assembler source
-#define	FILEFMT_BIN		2
-#define	FILEFMT_RIM		3
-#define	FILEFMT_TXT		4	// Text version of RIM: <addr> <code>
-
 #define FILELEN_MAX		256	// Max filename length
 
 static int load(int argc, char *argv[])
@@ -627,42 +884,21 @@ static int load(int argc, char *argv[])
 		return 0;
 	}
 
-	if ((sep = strrchr(file_inp, '.')) && strlen(sep+1) < 5) {
-		if (!strcasecmp(sep+1,"asm8"))
-			ffmt = FILEFMT_ASM;
-		else if (!strcasecmp(sep+1,"bin") || !strcasecmp(sep+1,"pb"))
-			ffmt = FILEFMT_BIN;
-		else if (!strcasecmp(sep+1,"rim") || !strcasecmp(sep+1,"pm"))
-			ffmt = FILEFMT_RIM;
-		else if (!strcasecmp(sep+1,"txt"))
-			ffmt = FILEFMT_TXT;
-		else {
-			printf("Unknown file extension\n");
-			return 0;
-		}
-		if (disasm) {
-			if ((len = sep - file_inp) > FILELEN_MAX) {
-				printf("Filename is too long\n");
-				return 0;
-			}
-			memcpy(file_out, file_inp, len);
-		}
-	} else if ((sep = strrchr(file_inp, '-'))) {
-		if (!strcasecmp(sep+1,"pb"))
-			ffmt = FILEFMT_BIN;
-		else if (!strcasecmp(sep+1,"pm"))
-			ffmt = FILEFMT_RIM;
-		else {
-			printf("Unknown file type\n");
+	if (!(ffmt = load_format(file_inp))) {
+		printf("Unknown file type\n");
+		return 0;
+	}
+
+	if (disasm) {
+		if ((sep = strrchr(file_inp, '.')) && strlen(sep+1) < 5)
+			len = sep - file_inp;
+		else
+			len = strlen(file_inp);
+		if (len > FILELEN_MAX) {
+			printf("Filename is too long\n");
 			return 0;
 		}
-		if (disasm) {
-			if ((len = strlen(file_inp)) > FILELEN_MAX) {
-				printf("Filename is too long\n");
-				return 0;
-			}
-			memcpy(file_out, file_inp, len);
-		}
+		memcpy(file_out, file_inp, len);
 	}
 
 	if (!(inp = fopen(file_inp,"r"))) {
@@ -680,20 +916,7 @@ static int load(int argc, char *argv[])
 		printf("Disassembling to '%s'\n", file_out);
 	}
 
-	switch (ffmt) {
-	case FILEFMT_ASM:
-		load_asm(inp,out,stderr);
-		break;
-	case FILEFMT_BIN:
-		load_bin(inp,out,stderr);
-		break;
-	case FILEFMT_RIM:
-		load_rim(inp,out,stderr);
-		break;
-	case FILEFMT_TXT:
-		load_txt(inp,out,stderr);
-		break;
-	}
+	load_file(inp,ffmt,out,stderr);
 
 	if (out && out != stdout) fclose(out);
 
@@ -725,6 +948,24 @@ static int set_log(int argc, char *argv[])
 	return 0;
 }
 
+static int rate(int argc, char *argv[])
+{
+	const char *name;
+
+	if (argc > 2) {
+		printf("Invalid number of arguments\n");
+		return 0;
+	}
+
+	if (!(name = pdp8_rate(M, argc == 2 ? argv[1] : 0))) {
+		printf("Invalid rate: %s\n", argv[1]);
+		return 0;
+	}
+	printf("Device rate is %s\n", name);
+
+	return 0;
+}
+
 static int quit(int argc, char *argv[])
 {
 	WORD args[MAXARGS+1];
@@ -744,19 +985,38 @@ static int run(int argc, char *argv[])
 		return 0;
 
 	cpu_run(args[1], 0);
+	run_stopped();
 
-	if (!RUN && (IR == HALT)) {
-		if ((BP_NUM = bp_check(PC-1))) {
-			--PC;
-			MP[PC] = bptable[BP_NUM-1].inst;	// Restore original instruction
-			printf("\nBreakpoint %o @ %05o\n", BP_NUM, PC);
-			con_trace_next(PC,MP[PC]);
-		} else
-			printf("\n\nHALT @ %05o  L=%d  AC=%04o\n",PC-1,L,AC);
+	tty_exit();
+
+	return 0;
+}
+
+/* save <file> */
+static int save(int argc, char *argv[])
+{
+	if (argc != 2) {
+		printf("save <file>\n");
+		return 0;
 	}
 
-	tty_exit();
+	if (pdp8_save(M, argv[1]))
+		printf("Could not save '%s'\n", argv[1]);
+	return 0;
+}
+
+/* restore <file> */
+static int restore(int argc, char *argv[])
+{
+	if (argc != 2) {
+		printf("restore <file>\n");
+		return 0;
+	}
 
+	if (pdp8_restore(M, argv[1]))
+		printf("Could not restore '%s'\n", argv[1]);
+	else
+		BP_NUM = 0;		/* Not stopped at one any more */
 	return 0;
 }
 
@@ -816,27 +1076,45 @@ static int set_swt(int argc, char *argv[])
 /* si */
 static int single_step(UNUSED int argc, UNUSED char *argv[])
 {
-	// If the instruction we're about to execute is a breakpoint,
-	// replace it with the original instruction
-	if ((BP_NUM = bp_check(PC)))
-		MP[PC] = bptable[BP_NUM-1].inst;
-
+	BP_NUM = brk_at(PC);	/* Always leave a breakpoint at PC */
 	cpu_run(PC, 1);
+	con_trace_next(PC, MP[PC]);
 
-	int bn;
-	WORD inst; 
+	return 0;
+}
 
-	if ((bn = bp_check(PC)))		// If next instruction is a breakpoint
-		inst = bptable[bn-1].inst;	// Show original instruction, not HLT
-	else
-		inst = MP[PC];
+/*
+   Binary trace
 
-	con_trace_next(PC,inst);
+   trace bin <file> [<n>] records the instructions into a ring of the
+   last n (decimal, TRACE_RECORDS by default) in file, which is mapped
+   into memory (see trace.c), and pdp8trace decodes it afterwards. It
+   costs a few stores per instruction instead of formatting a line.
+*/
+#define	TRACE_RECORDS	(4UL << 20)	/* 64 MB */
+
+static int trace_bin(int argc, char *argv[])
+{
+	unsigned long n = TRACE_RECORDS;
+	char *end;
+
+	if (argc < 3 || argc > 4) {
+		printf("Invalid number of arguments\n");
+		printf("trace bin <file> [<n>]\n");
+		return 0;
+	}
+	if (argc == 4 && (!(n = strtoul(argv[3], &end, 10)) || *end)) {
+		printf("Invalid number: %s\n", argv[3]);
+		return 0;
+	}
+	if (pdp8_trace(M, argv[2], n))
+		printf("Could not create trace file \"%s\"\n", argv[2]);
+	printf("Tracing is %s\n", trace ? "ON" : "OFF");
 
 	return 0;
 }
 
-/* trace 0|1 [<file>]*/
+/* trace 0|1 [<file>] or trace bin <file> [<n>] */
 static int set_trace(int argc, char *argv[])
 {
 	WORD args[MAXARGS+1];
@@ -845,6 +1123,10 @@ static int set_trace(int argc, char *argv[])
 	// Close previous trace file if one was open
 	if (tracef && tracef != stdout) fclose(tracef);
 	tracef = stdout;
+	pdp8_trace(M, 0, 0);
+
+	if (argc > 1 && !strcmp(argv[1], "bin"))
+		return trace_bin(argc, argv);
 
 	// New trace file?
 	if (argc == 3) {
@@ -874,6 +1156,372 @@ static int set_trace(int argc, char *argv[])
 	return 0;
 }
 
+/*
+   Instruction history
+
+   The engines keep the last instructions executed (HIST_SIZE by
+   default) in a ring, always, at the cost of a few stores each (see
+   HIST_ADD). history [<n>] disassembles the last n (decimal), oldest
+   first, with the registers as each one left them; history size <n>
+   changes how many are kept.
+*/
+#define	HIST_SHOW	20		/* Shown by default */
+
+static int history(int argc, char *argv[])
+{
+	unsigned long n = HIST_SHOW;
+	unsigned i, kept;
+	char *end;
+	DINSTR inst;
+	HIST *h;
+
+	if (argc == 3 && !strcmp(argv[1], "size")) {
+		if (!(n = strtoul(argv[2], &end, 10)) || *end) {
+			printf("Invalid number: %s\n", argv[2]);
+			return 0;
+		}
+		if (cpu_history(n))
+			printf("Out of memory\n");
+		printf("Keeping the last %u instructions\n", M->hist_mask + 1);
+		return 0;
+	}
+	if (argc > 2 || (argc == 2 && (!(n = strtoul(argv[1], &end, 10)) || *end))) {
+		printf("history [<n>|size <n>]\n");
+		return 0;
+	}
+
+	kept = M->hist_pos > M->hist_mask ? M->hist_mask + 1 : M->hist_pos;
+	if (n > kept)
+		n = kept;
+	for (i = M->hist_pos - n; i != M->hist_pos; ++i) {
+		h = &M->hist[i & M->hist_mask];
+		inst.addr = h->pc;
+		inst.inst = h->ir;
+		cpu_disasm(&inst);
+		printf("PC=%05o [%04o] ", h->pc, h->ir);
+		if (inst.args[0])
+			printf("%-8s %-8s", inst.name, inst.args);
+		else
+			printf("%-16s ", inst.name);
+		printf("L=%d  AC=%04o  MQ=%04o", h->l, h->ac, h->mq);
+		if (h->ir < 06000)	/* Memory reference */
+			printf("  MA=%05o", h->ma);
+		printf("\n");
+	}
+
+	return 0;
+}
+
+/*
+   Reverse execution
+
+   reverse on [<n>] records from now on what it takes to go back, with
+   a snapshot every n instructions (decimal, REV_INTERVAL by default),
+   and reverse off forgets it (see rev.c). rstep [<n>] goes back n
+   instructions (decimal, 1 by default). rcontinue goes back to where
+   the last breakpoint or watchpoint hit would have stopped, or to the
+   oldest snapshot if none would have.
+*/
+static int reverse(int argc, char *argv[])
+{
+	unsigned long n = REV_INTERVAL;
+	unsigned long long oldest;
+	char *end;
+
+	if (argc == 2 && !strcmp(argv[1], "off"))
+		rev_start(0);
+	else if ((argc == 2 || argc == 3) && !strcmp(argv[1], "on")) {
+		if (argc == 3 && (!(n = strtoul(argv[2], &end, 10)) || *end)) {
+			printf("Invalid number: %s\n", argv[2]);
+			return 0;
+		}
+		if (rev_start(n))
+			printf("Out of memory\n");
+	} else if (argc != 1) {
+		printf("reverse [on [<n>]|off]\n");
+		return 0;
+	}
+
+	if (rev_status(&n, &oldest))
+		printf("Reverse execution is ON (a snapshot every %lu instructions, %llu back)\n",
+			n, cpu_time() - oldest);
+	else
+		printf("Reverse execution is OFF\n");
+
+	return 0;
+}
+
+// rstep [<n>]
+static int rev_step(int argc, char *argv[])
+{
+	unsigned long n = 1, interval;
+	unsigned long long oldest;
+	char *end;
+
+	if (argc > 2 || (argc == 2 && (!(n = strtoul(argv[1], &end, 10)) || *end))) {
+		printf("rstep [<n>]\n");
+		return 0;
+	}
+	if (!rev_status(&interval, &oldest)) {
+		printf("Reverse execution is OFF\n");
+		return 0;
+	}
+	if (n > cpu_time() - oldest) {
+		printf("Can only go back %llu instructions\n", cpu_time() - oldest);
+		return 0;
+	}
+
+	rev_back(cpu_time() - n);
+	BP_NUM = brk_at(PC);	/* Always leave a breakpoint at PC */
+	con_trace_next(PC, MP[PC]);
+	tty_exit();
+
+	return 0;
+}
+
+// rcontinue
+static int rev_cont(UNUSED int argc, UNUSED char *argv[])
+{
+	unsigned long interval;
+	unsigned long long oldest;
+	int rc;
+
+	if (!rev_status(&interval, &oldest)) {
+		printf("Reverse execution is OFF\n");
+		return 0;
+	}
+
+	if (!(rc = rev_continue()))
+		run_stopped();
+	else {
+		printf(rc > 0 ? "\nOldest snapshot @ %05o\n" : "\nStopped @ %05o\n", PC);
+		BP_NUM = brk_at(PC);
+		con_trace_next(PC, MP[PC]);
+	}
+	tty_exit();
+
+	return 0;
+}
+
+/*
+   Execution profile
+
+   While the profile is on, cpu_attention() is called after every
+   instruction (as for a trace) and counts it in prof_count, at the
+   address it was executed from. Nothing is counted when it is off.
+   The report shows the n (decimal) addresses executed most, with
+   their instructions as they are now in memory, and the counts by
+   page and by field.
+*/
+#define	PROF_TOP	20		/* Addresses and pages shown by default */
+#define	PROF_PAGES	256		/* Pages in 32K words */
+#define	PROF_FIELDS	8
+
+static const unsigned long long *prof_sort;	/* Counts for prof_cmp() */
+
+/* Compare two indexes into prof_sort, the highest count first */
+static int prof_cmp(const void *a, const void *b)
+{
+	unsigned long long ca = prof_sort[*(const unsigned *)a];
+	unsigned long long cb = prof_sort[*(const unsigned *)b];
+
+	if (ca != cb)
+		return ca < cb ? 1 : -1;
+	return *(const unsigned *)a < *(const unsigned *)b ? -1 : 1;
+}
+
+/* Sort the nonzero counts in count[0..n-1] into index. Return how many */
+static unsigned prof_rank(const unsigned long long *count, unsigned n, unsigned *index)
+{
+	unsigned i, k = 0;
+
+	for (i = 0; i < n; ++i)
+		if (count[i])
+			index[k++] = i;
+	prof_sort = count;
+	qsort(index, k, sizeof(unsigned), prof_cmp);
+	return k;
+}
+
+static void prof_report(unsigned ntop)
+{
+	unsigned long long pages[PROF_PAGES];
+	unsigned long long fields[PROF_FIELDS];
+	unsigned long long total = 0;
+	unsigned index[PROF_PAGES];
+	unsigned *addrs;
+	unsigned i, n;
+	DINSTR inst;
+
+	memset(pages, 0, sizeof(pages));
+	memset(fields, 0, sizeof(fields));
+	for (i = 0; i < memwords; ++i) {
+		total += prof_count[i];
+		pages[i >> 7] += prof_count[i];
+		fields[i >> 12] += prof_count[i];
+	}
+	if (!total) {
+		printf("Nothing has been executed\n");
+		return;
+	}
+	if (!(addrs = malloc(memwords * sizeof(unsigned)))) {
+		printf("Out of memory\n");
+		return;
+	}
+
+	printf("\n%llu instructions\n", total);
+
+	printf("\n           Count      %%  Addr   Instruction\n");
+	printf("----------------  -----  -----  -----------\n");
+	n = prof_rank(prof_count, memwords, addrs);
+	for (i = 0; i < n && i < ntop; ++i) {
+		inst.addr = addrs[i];
+		inst.inst = MP[addrs[i]];
+		cpu_disasm(&inst);
+		printf("%16llu  %5.1f  %05o  %04o  %s  %s\n", prof_count[addrs[i]],
+			100.0 * prof_count[addrs[i]] / total, addrs[i],
+			inst.inst, inst.name, inst.args);
+	}
+	free(addrs);
+
+	printf("\n           Count      %%  Page\n");
+	printf("----------------  -----  -----------\n");
+	n = prof_rank(pages, memwords >> 7, index);
+	for (i = 0; i < n && i < ntop; ++i)
+		printf("%16llu  %5.1f  %05o-%05o\n", pages[index[i]],
+			100.0 * pages[index[i]] / total, index[i] << 7, (index[i] << 7) + 0177);
+
+	printf("\n           Count      %%  Field\n");
+	printf("----------------  -----  -----\n");
+	n = prof_rank(fields, nfields, index);
+	for (i = 0; i < n; ++i)
+		printf("%16llu  %5.1f  %o\n", fields[index[i]],
+			100.0 * fields[index[i]] / total, index[i]);
+}
+
+// profile on|off|report [<n>]
+static int set_profile(int argc, char *argv[])
+{
+	unsigned long ntop = PROF_TOP;
+	char *end;
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		if (!prof_count && !(prof_count = malloc(memwords * sizeof(unsigned long long)))) {
+			printf("Out of memory\n");
+			return 0;
+		}
+		memset(prof_count, 0, memwords * sizeof(unsigned long long));
+		profile = 1;
+	} else if (argc == 2 && !strcmp(argv[1], "off"))
+		profile = 0;
+	else if ((argc == 2 || argc == 3) && !strcmp(argv[1], "report")) {
+		if (argc == 3 && (!(ntop = strtoul(argv[2], &end, 10)) || *end)) {
+			printf("Invalid number: %s\n", argv[2]);
+			return 0;
+		}
+		if (!prof_count)
+			printf("There is no profile\n");
+		else
+			prof_report(ntop);
+		return 0;
+	} else if (argc != 1) {
+		printf("profile on|off|report [<n>]\n");
+		return 0;
+	}
+
+	printf("Profiling is %s\n", profile ? "ON" : "OFF");
+
+	return 0;
+}
+
+/*
+   Instruction mix
+
+   While stats is on, cpu_attention() is called after every
+   instruction and counts it by opcode, OPR group, addressing mode
+   (memory references) and IOT device and function. The counts are
+   kept until cleared, and shown by stats and when leaving.
+*/
+static void show_stats(void)
+{
+	static const char *const ops[8] = {
+		"AND", "TAD", "ISZ", "DCA", "JMS", "JMP", "IOT", "OPR"
+	};
+	static const char *const modes[MODES] = {
+		"Direct, page 0", "Direct, current page", "Indirect, page 0",
+		"Indirect, current page", "Auto-index"
+	};
+	unsigned long long total = 0, refs = 0;
+	unsigned index[01000];
+	unsigned i, n;
+	DINSTR inst;
+
+	for (i = 0; i < 8; ++i)
+		total += stats_count.op[i];
+	for (i = 0; i < MODES; ++i)
+		refs += stats_count.mode[i];
+	if (!total)
+		return;
+
+	printf("\n%llu instructions\n", total);
+
+	printf("\n           Count      %%  Opcode\n");
+	printf("----------------  -----  ----------\n");
+	for (i = 0; i < 8; ++i)
+		printf("%16llu  %5.1f  %s\n", stats_count.op[i],
+			100.0 * stats_count.op[i] / total, ops[i]);
+	for (i = 0; i < 3; ++i)
+		printf("%16llu  %5.1f  OPR group %u\n", stats_count.opr[i],
+			100.0 * stats_count.opr[i] / total, i + 1);
+
+	if (refs) {
+		printf("\n           Count      %%  Addressing (memory references)\n");
+		printf("----------------  -----  ------------------------------\n");
+		for (i = 0; i < MODES; ++i)
+			printf("%16llu  %5.1f  %s\n", stats_count.mode[i],
+				100.0 * stats_count.mode[i] / refs, modes[i]);
+	}
+
+	if (stats_count.op[6]) {
+		printf("\n           Count      %%  Dev  Fun  IOT\n");
+		printf("----------------  -----  ---  ---  ----------\n");
+		n = prof_rank(stats_count.iot, 01000, index);
+		for (i = 0; i < n; ++i) {
+			inst.addr = 0;
+			inst.inst = 06000 | index[i];
+			cpu_disasm(&inst);
+			printf("%16llu  %5.1f  %02o   %o    %04o %s\n", stats_count.iot[index[i]],
+				100.0 * stats_count.iot[index[i]] / stats_count.op[6],
+				index[i] >> 3, index[i] & 7, inst.inst, inst.name);
+		}
+	}
+}
+
+// stats [on|off|clear]
+static int set_stats(int argc, char *argv[])
+{
+	if (argc == 1) {
+		show_stats();
+		printf("\nCounting is %s\n", stats ? "ON" : "OFF");
+		return 0;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "on"))
+		stats = 1;
+	else if (argc == 2 && !strcmp(argv[1], "off"))
+		stats = 0;
+	else if (argc == 2 && !strcmp(argv[1], "clear"))
+		memset(&stats_count, 0, sizeof(STATS));
+	else {
+		printf("stats [on|off|clear]\n");
+		return 0;
+	}
+
+	printf("Counting is %s\n", stats ? "ON" : "OFF");
+
+	return 0;
+}
+
 // assign <dev> <file>
 static int assign(int argc, char *argv[])
 {
@@ -5,5 +5,6 @@
 extern void	console(void);
 extern void	con_stop(void);
 extern void	con_trace(WORD addr, WORD code);
+extern void	con_watch(int n, WORD addr, int write);
 
 #endif	/* _console_h */
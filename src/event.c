@@ -0,0 +1,145 @@
+#include <stdio.h>
+
+#include "event.h"
+#include "pdp8.h"
+
+/*
+   Event queue
+
+   Devices schedule their flag and interrupt transitions here instead
+   of being polled. The pending events are kept in a binary min-heap
+   ordered by time, then by event number, so that events due at the
+   same time always run in the same order. The CPU sets its attention
+   countdown to the first one (see cpu_attention), so nothing is
+   checked between instructions while no event is due. Each machine
+   has its own queue.
+*/
+
+#define	events	(M->st.events)
+#define	heap	(M->st.ev_heap)	/* Pending events, heap[0] is the first due */
+#define	nheap	(M->st.ev_nheap)
+#define	handler	(M->ev_fn)
+#define	fired	(M->ev_fired)	/* # of events run (see cpu_idle) */
+
+/* Nothing pending */
+void ev_init(void)
+{
+	int ev;
+
+	for (ev = 0; ev < EV_MAX; ++ev)
+		events[ev].pos = -1;
+	nheap = 0;
+}
+
+/* Return 1 if event a is due before event b */
+static int ev_before(int a, int b)
+{
+	if (events[a].when != events[b].when)
+		return events[a].when < events[b].when;
+	return a < b;
+}
+
+static void ev_place(int i, int ev)
+{
+	heap[i] = ev;
+	events[ev].pos = i;
+}
+
+/* Restore the heap order around position i */
+static void ev_fix(int i)
+{
+	int ev = heap[i];
+	int child;
+
+	while (i > 0 && ev_before(ev, heap[(i - 1) / 2])) {
+		ev_place(i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while ((child = 2 * i + 1) < nheap) {
+		if (child + 1 < nheap && ev_before(heap[child + 1], heap[child]))
+			++child;
+		if (!ev_before(heap[child], ev))
+			break;
+		ev_place(i, heap[child]);
+		i = child;
+	}
+	ev_place(i, ev);
+}
+
+/* Make fn the handler of event ev */
+void ev_handler(int ev, EVENT_FN fn)
+{
+	handler[ev] = fn;
+}
+
+/* Schedule event ev delay instructions from now (0=at once) */
+void ev_schedule(int ev, unsigned long delay)
+{
+	if (!delay) {
+		ev_cancel(ev);
+		++fired;
+		(*handler[ev])();
+		return;
+	}
+
+	events[ev].when = cpu_time() + delay;
+	if (events[ev].pos < 0) {
+		events[ev].pos = nheap;
+		heap[nheap++] = ev;
+	}
+	ev_fix(events[ev].pos);
+
+	if (heap[0] == ev)	/* Sooner than the CPU expected */
+		cpu_request();
+}
+
+void ev_cancel(int ev)
+{
+	int i = events[ev].pos;
+
+	if (i < 0)
+		return;
+	events[ev].pos = -1;
+	if (i < --nheap) {
+		heap[i] = heap[nheap];
+		ev_fix(i);
+	}
+}
+
+int ev_pending(int ev)
+{
+	return events[ev].pos >= 0;
+}
+
+/* Time of the first pending event */
+unsigned long long ev_next(void)
+{
+	return nheap ? events[heap[0]].when : EV_NEVER;
+}
+
+/* Time of the first pending event other than ev */
+unsigned long long ev_next_other(int ev)
+{
+	int i;
+
+	if (!nheap)
+		return EV_NEVER;
+	if (heap[0] != ev)
+		return events[heap[0]].when;
+	if (nheap == 1)
+		return EV_NEVER;
+	i = nheap > 2 && ev_before(heap[2], heap[1]) ? 2 : 1;	/* The next is a child */
+	return events[heap[i]].when;
+}
+
+/* Run all the events due by now */
+void ev_run(unsigned long long now)
+{
+	int ev;
+
+	while (nheap && events[ev = heap[0]].when <= now) {
+		ev_cancel(ev);
+		++fired;
+		(*handler[ev])();
+	}
+}
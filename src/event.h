@@ -0,0 +1,40 @@
+#ifndef	_event_h
+#define _event_h
+
+/*
+   Events, one per source. Time is counted in instructions executed
+   (see cpu_time). Scheduling an event that is already pending moves
+   it to the new time. Each event has a handler, set once by the
+   device that owns it, so that the queue is plain data (see STATE).
+*/
+#define	EV_COUNT		0	/* End of the instruction count of cpu_run() */
+#define	EV_TTY_IN		1	/* Keyboard poll */
+#define	EV_TTY_OUT		2	/* Teleprinter done */
+#define	EV_PPT_READER	3	/* Paper tape reader done */
+#define	EV_PPT_PUNCH	4	/* Paper tape punch done */
+#define	EV_CLOCK		5	/* Real time clock tick */
+#define	EV_DISK			6	/* Disk transfer done */
+#define	EV_TTY_FLUSH	7	/* Teleprinter output flush */
+#define	EV_REV			8	/* Reverse execution snapshot */
+#define	EV_MAX			9
+
+#define	EV_NEVER		(~0ULL)	/* ev_next() with nothing pending */
+
+typedef void (*EVENT_FN)(void);
+
+/* An event (kept in the machine, see pdp8.h) */
+typedef struct {
+	unsigned long long when;	/* Time it is due */
+	int pos;					/* Index in the heap, -1 if not pending */
+} EVENT;
+
+extern void	ev_cancel(int ev);
+extern void	ev_handler(int ev, EVENT_FN fn);
+extern void	ev_init(void);
+extern unsigned long long ev_next(void);
+extern unsigned long long ev_next_other(int ev);
+extern int	ev_pending(int ev);
+extern void	ev_run(unsigned long long now);
+extern void	ev_schedule(int ev, unsigned long delay);
+
+#endif	/* _event_h */
@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "pdp8.h"
+#include "libpdp8.h"
+
+/*
+   Clones (fork)
+
+   pdp8_fork() clones a machine into a child process with fork(), so
+   the clone starts with the exact state of the machine and shares
+   its memory (MP and everything else) copy-on-write: nothing is
+   copied until one of them stores into it. The clone is prepared by
+   a setup callback in the child (to change SR, attach the devices to
+   something of its own...), runs from PC for up to n instructions
+   (0=until HLT) and sends a PDP8_STATUS back through a pipe before
+   exiting. The parent is not stopped and collects it with
+   pdp8_join().
+
+   The clone keeps the files assigned to the devices of the machine,
+   which it shares with the parent, so the setup should attach the
+   devices the clone uses. It runs without trace and stop callbacks,
+   nor reverse execution.
+*/
+
+struct pdp8_clone {
+	pid_t pid;
+	int fd;			/* Read end of the status pipe */
+};
+
+/* Run the clone and exit (child) */
+static void fork_child(PDP8 *m, unsigned long n, PDP8_SETUP setup, void *ctx, int fd)
+{
+	PDP8_STATUS status;
+	unsigned long long start;
+
+	M = m;
+	trace = 0;
+	profile = 0;
+	stats = 0;
+	M->on_trace = 0;
+	M->on_stop = 0;
+	M->on_watch = 0;
+	rev_start(0);
+	if (setup)
+		(*setup)(m, ctx);
+
+	start = cpu_time();
+	cpu_run(PC, n);
+	status.count = cpu_time() - start;
+	status.halted = pdp8_halted(m);
+	status.breakpoint = BP_NUM;
+	status.watchpoint = WATCH_NUM;
+	status.pc = PC;
+	status.l = L;
+	status.ac = AC;
+
+	fflush(0);	/* The streams opened by setup */
+	_exit(write(fd, &status, sizeof(status)) == sizeof(status) ? 0 : 1);
+}
+
+/*
+   Clone m and run the clone for up to n instructions (0=until HLT)
+   in a child process. Return the clone, or 0 if it couldn't be made.
+*/
+PDP8_CLONE *pdp8_fork(PDP8 *m, unsigned long n, PDP8_SETUP setup, void *ctx)
+{
+	PDP8_CLONE *c;
+	int fds[2];
+
+	if (!(c = malloc(sizeof(PDP8_CLONE))))
+		return 0;
+	if (pipe(fds)) {
+		free(c);
+		return 0;
+	}
+
+	fflush(0);	/* Or the child would write the buffers again */
+	if ((c->pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		free(c);
+		return 0;
+	}
+	if (!c->pid) {
+		close(fds[0]);
+		fork_child(m, n, setup, ctx, fds[1]);
+	}
+
+	close(fds[1]);
+	c->fd = fds[0];
+	return c;
+}
+
+/*
+   Get the status of clone c, waiting for it to end if wait is 1.
+   Return 0 if it is still running (wait=0), 1 if it ended with its
+   status in *status or -1 if it failed. c is freed unless 0.
+*/
+int pdp8_join(PDP8_CLONE *c, int wait, PDP8_STATUS *status)
+{
+	pid_t pid;
+	int rc;
+
+	while ((pid = waitpid(c->pid, 0, wait ? 0 : WNOHANG)) < 0)
+		if (errno != EINTR)
+			break;
+	if (!pid)
+		return 0;
+
+	rc = read(c->fd, status, sizeof(PDP8_STATUS)) == sizeof(PDP8_STATUS) ? 1 : -1;
+	close(c->fd);
+	free(c);
+	return rc;
+}
+
+/* Stop clone c and free it */
+void pdp8_kill(PDP8_CLONE *c)
+{
+	kill(c->pid, SIGKILL);
+	waitpid(c->pid, 0, 0);
+	close(c->fd);
+	free(c);
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdp8.h"
+#include "libpdp8.h"
+
+/*
+   Library API (see libpdp8.h)
+
+   The simulator works on the machine pointed to by M. Every call
+   here makes its machine the current one first, and the console
+   does the same once at startup. M is per thread, so different
+   machines can run at the same time in different threads. Loading
+   uses the assembler, which is not reentrant, so loads must not
+   overlap.
+*/
+THREAD_LOCAL PDP8 *M;	/* Current machine */
+
+/* Create a machine with kwords of memory (4-32, a multiple of 4) */
+PDP8 *pdp8_create(size_t kwords)
+{
+	PDP8 *m;
+
+	if (kwords < 4 || kwords > 32 || (kwords & 3))
+		return 0;
+	if (!(m = calloc(1, sizeof(PDP8))))
+		return 0;
+
+	M = m;
+	cpu_init(kwords);
+	return m;
+}
+
+void pdp8_destroy(PDP8 *m)
+{
+	M = m;
+	cpu_deinit();
+	free(m);
+	M = 0;
+}
+
+/*
+   Select the execution engine by name (decoded, threaded, block, jit).
+   Return 0, 1 if jit is not available here and block is used
+   instead, or -1 if there's no such engine.
+*/
+int pdp8_engine(PDP8 *m, const char *name)
+{
+	M = m;
+	if (!strcmp(name,"decoded"))
+		cpu_engine = ENGINE_DECODED;
+	else if (!strcmp(name,"threaded"))
+		cpu_engine = ENGINE_THREADED;
+	else if (!strcmp(name,"block"))
+		cpu_engine = ENGINE_BLOCK;
+	else if (!strcmp(name,"jit")) {
+		if (!jit_available()) {
+			cpu_engine = ENGINE_BLOCK;
+			return 1;
+		}
+		cpu_engine = ENGINE_JIT;
+	} else
+		return -1;
+	return 0;
+}
+
+/*
+   Select the device rate by name: max (devices are done at once),
+   asr33 (10 cps) or highspeed (10 cps, reader 300 cps, punch 50 cps).
+   Return the name of the rate now selected (the current one if name
+   is 0), or 0 if there's no such rate.
+*/
+const char *pdp8_rate(PDP8 *m, const char *name)
+{
+	static const char *const names[] = { "max", "asr33", "highspeed" };
+	int i;
+
+	M = m;
+	for (i = 0; name && i < (int)(sizeof(names) / sizeof(names[0])); ++i)
+		if (!strcmp(name, names[i]))
+			break;
+	if (name) {
+		if (i == sizeof(names) / sizeof(names[0]))
+			return 0;
+		dev_rate = i;
+	}
+	return names[dev_rate];
+}
+
+/* Load a file, in the format given by its name. Return 0 if done */
+int pdp8_load(PDP8 *m, const char *fname)
+{
+	FILE *inp;
+	int ffmt;
+	int rc;
+
+	M = m;
+	if (!(ffmt = load_format(fname)))
+		return -1;
+	if (!(inp = fopen(fname,"r")))
+		return -1;
+	rc = load_file(inp, ffmt, 0, stderr);
+	fclose(inp);
+	return rc;
+}
+
+/* Execute up to n instructions from PC. Return how many were */
+unsigned long pdp8_step(PDP8 *m, unsigned long n)
+{
+	unsigned long long start;
+
+	M = m;
+	if (!n)
+		return 0;
+	start = cpu_time();
+	cpu_run(PC, n);
+	return cpu_time() - start;
+}
+
+/* Run from PC until HLT (or CTRL-C). Return 1 if halted */
+int pdp8_run(PDP8 *m)
+{
+	M = m;
+	cpu_run(PC, 0);
+	return pdp8_halted(m);
+}
+
+/* Return 1 if the last instruction executed was a HLT */
+int pdp8_halted(PDP8 *m)
+{
+	M = m;
+	return (IR & 07401) == 07400 && HLT(IR);
+}
+
+unsigned pdp8_read(PDP8 *m, unsigned addr)
+{
+	M = m;
+	return addr < memwords ? MP[addr] : 0;
+}
+
+void pdp8_write(PDP8 *m, unsigned addr, unsigned value)
+{
+	M = m;
+	if (addr < memwords)
+		MEM_STORE(addr, value & WORD_MASK);
+}
+
+unsigned pdp8_get(PDP8 *m, int reg)
+{
+	M = m;
+	switch (reg) {
+	case PDP8_AC:	return AC;
+	case PDP8_L:	return L;
+	case PDP8_MQ:	return MQ;
+	case PDP8_PC:	return PC;
+	case PDP8_IF:	return IF >> FIELD_SHFT;
+	case PDP8_DF:	return DF >> FIELD_SHFT;
+	case PDP8_SR:	return SR;
+	}
+	return 0;
+}
+
+void pdp8_set(PDP8 *m, int reg, unsigned value)
+{
+	M = m;
+	switch (reg) {
+	case PDP8_AC:	AC = value & AC_MASK; break;
+	case PDP8_L:	L = value & 1; break;
+	case PDP8_MQ:	MQ = value & WORD_MASK; break;
+	case PDP8_PC:	PC = value % memwords; break;
+	case PDP8_IF:	IF = IB = (value % nfields) << FIELD_SHFT; break;
+	case PDP8_DF:	DF = (value % nfields) << FIELD_SHFT; break;
+	case PDP8_SR:	SR = value & WORD_MASK; break;
+	}
+}
+
+/* Feed the keyboard (03) or the paper tape reader (01) from fn */
+void pdp8_attach_input(PDP8 *m, int dev, PDP8_INPUT fn, void *ctx)
+{
+	switch (dev) {
+	case 003:
+		m->keyb_fn = fn;
+		m->keyb_ctx = ctx;
+		break;
+	case 001:
+		m->reader_fn = fn;
+		m->reader_ctx = ctx;
+		break;
+	}
+}
+
+/* Send the teleprinter (04) or the paper tape punch (02) to fn */
+void pdp8_attach_output(PDP8 *m, int dev, PDP8_OUTPUT fn, void *ctx)
+{
+	switch (dev) {
+	case 004:
+		m->tty_fn = fn;
+		m->tty_ctx = ctx;
+		break;
+	case 002:
+		m->punch_fn = fn;
+		m->punch_ctx = ctx;
+		break;
+	}
+}
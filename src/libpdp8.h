@@ -0,0 +1,81 @@
+#ifndef	_libpdp8_h
+#define _libpdp8_h
+
+#include <stddef.h>
+
+/*
+   PDP-8 simulator library (libpdp8.a)
+
+   Each machine created by pdp8_create() has its own memory, registers
+   and devices, so any number of them can be run in the same process,
+   at the same time in different threads. Only pdp8_load() must not
+   be called by two threads at once. The pdp8 program is a console
+   on top of this.
+
+   Addresses are 15 bits (field included), like the PC. The keyboard
+   (device 03) and the paper tape reader (01) can be fed by an input
+   callback, which returns the next character or -1 if there's none
+   (end of tape for the reader). The teleprinter (04) and the punch
+   (02) can be sent to an output callback. Devices without callbacks
+   use the host: stdout for the teleprinter and the files assigned by
+   the console for the rest.
+
+   pdp8_save() writes the state of a machine (memory, registers and
+   devices) to a file, which pdp8_restore() reads back into a machine
+   with the same memory size (see snapshot.c).
+
+   pdp8_trace() records every instruction executed into a binary
+   trace file of a fixed size, read by pdp8trace (see trace.c).
+
+   pdp8_fork() runs a clone of a machine in a child process, sharing
+   its memory copy-on-write. Its final state is collected with
+   pdp8_join() (see fork.c).
+*/
+typedef struct pdp8 PDP8;
+
+typedef int		(*PDP8_INPUT)(void *ctx);
+typedef void	(*PDP8_OUTPUT)(void *ctx, int ch);
+
+/* A clone made by pdp8_fork() and how it ended */
+typedef struct pdp8_clone PDP8_CLONE;
+typedef void	(*PDP8_SETUP)(PDP8 *clone, void *ctx);
+
+typedef struct {
+	int halted;				/* 1 if stopped by a HLT */
+	int breakpoint;			/* Stopped at this breakpoint before pc (0=none) */
+	int watchpoint;			/* Stopped by this watchpoint (0=none) */
+	unsigned long count;	/* Instructions executed */
+	unsigned pc, l, ac;
+} PDP8_STATUS;
+
+/* Registers for pdp8_get() and pdp8_set() */
+#define	PDP8_AC		0	/* Accumulator */
+#define	PDP8_L		1	/* Link */
+#define	PDP8_MQ		2	/* Multiplier/Quotient */
+#define	PDP8_PC		3	/* Program counter (15 bits) */
+#define	PDP8_IF		4	/* Instruction field (0-7) */
+#define	PDP8_DF		5	/* Data field (0-7) */
+#define	PDP8_SR		6	/* Switch register */
+
+extern PDP8	*pdp8_create(size_t kwords);
+extern void	pdp8_destroy(PDP8 *m);
+extern int	pdp8_engine(PDP8 *m, const char *name);
+extern const char *pdp8_rate(PDP8 *m, const char *name);
+extern int	pdp8_load(PDP8 *m, const char *fname);
+extern unsigned long pdp8_step(PDP8 *m, unsigned long n);
+extern int	pdp8_run(PDP8 *m);
+extern int	pdp8_halted(PDP8 *m);
+extern unsigned	pdp8_read(PDP8 *m, unsigned addr);
+extern void	pdp8_write(PDP8 *m, unsigned addr, unsigned value);
+extern unsigned	pdp8_get(PDP8 *m, int reg);
+extern void	pdp8_set(PDP8 *m, int reg, unsigned value);
+extern void	pdp8_attach_input(PDP8 *m, int dev, PDP8_INPUT fn, void *ctx);
+extern void	pdp8_attach_output(PDP8 *m, int dev, PDP8_OUTPUT fn, void *ctx);
+extern int	pdp8_save(PDP8 *m, const char *fname);
+extern int	pdp8_restore(PDP8 *m, const char *fname);
+extern int	pdp8_trace(PDP8 *m, const char *fname, unsigned long records);
+extern PDP8_CLONE *pdp8_fork(PDP8 *m, unsigned long n, PDP8_SETUP setup, void *ctx);
+extern int	pdp8_join(PDP8_CLONE *c, int wait, PDP8_STATUS *status);
+extern void	pdp8_kill(PDP8_CLONE *c);
+
+#endif	/* _libpdp8_h */
@@ -1,25 +1,49 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "pdp8.h"
+#include "batch.h"
 #include "console.h"
+#include "log.h"
 
 void usage(char *name)
 {
 	fprintf(stderr, "Usage:\n");
-	fprintf(stderr, "%s [-m <kwords>]\n", name);
+	fprintf(stderr, "%s [-m <kwords>] [-e decoded|threaded|block|jit] [-r <snapshot>]\n", name);
+	fprintf(stderr, "%*s [--batch <jobs> [-j <threads>] [-o <results>]]\n", (int)strlen(name), "");
 }
 
 int main(int argc, char *argv[])
 {
 	size_t kwords = 4;
+	char *engine = "decoded";
+	char *jobs = 0;			/* Batch mode */
+	char *results = 0;
+	char *snapshot = 0;		/* Restored at startup */
+	int nthreads = 0;
 	char *pc;
 	int i;
 
 	for (i = 1; i < argc; ++i) {
 		pc = argv[i];
 		if (*pc == '-') {
-			if (!strncmp(pc,"-m",2)) {
+			if (!strcmp(pc,"--batch")) {		/* Batch mode */
+				if ((i+1) < argc) jobs = argv[++i];
+				else goto badop;
+			} else if (!strncmp(pc,"-j",2)) {	/* Batch threads */
+				if (strlen(pc) > 2) nthreads = atoi(pc+2);
+				else if ((i+1) < argc) nthreads = atoi(argv[++i]);
+				else goto badop;
+				if (nthreads < 1) {
+					fprintf(stderr, "Invalid number of threads: %d\n", nthreads);
+					return 1;
+				}
+			} else if (!strncmp(pc,"-o",2)) {	/* Batch results */
+				if (strlen(pc) > 2) results = pc+2;
+				else if ((i+1) < argc) results = argv[++i];
+				else goto badop;
+			} else if (!strncmp(pc,"-m",2)) {
 				if (strlen(pc) > 2) kwords = atoi(pc+2);
 				else if ((i+1) < argc) { ++i; kwords = atoi(argv[i]); }
 				else goto badop;
@@ -33,6 +57,15 @@ int main(int argc, char *argv[])
 					fprintf(stderr, "Must be a multiple of 4 (K words)\n");
 					return 1;
 				}
+			} else if (!strncmp(pc,"-e",2)) {	/* Execution engine */
+				if (strlen(pc) > 2) pc += 2;
+				else if ((i+1) < argc) pc = argv[++i];
+				else goto badop;
+				engine = pc;
+			} else if (!strncmp(pc,"-r",2)) {	/* Restore a snapshot */
+				if (strlen(pc) > 2) snapshot = pc+2;
+				else if ((i+1) < argc) snapshot = argv[++i];
+				else goto badop;
 			} else if (!strncmp(pc,"-h",2)) {	/* Help */
 				usage(argv[0]);
 				return 1;
@@ -44,14 +77,41 @@ badop:		fprintf(stderr,"Invalid option: %s\n", pc);
 		}
 	}
 	
+	if (!jobs && (nthreads || results)) {
+		fprintf(stderr, "-j and -o are only valid with --batch\n");
+		return 1;
+	}
+
+	pdp8_create(kwords);	/* The current machine from now on */
+	switch (pdp8_engine(M, engine)) {
+	case 1:
+		fprintf(stderr, "No JIT for this host, using 'block'\n");
+		break;
+	case -1:
+		fprintf(stderr, "Invalid execution engine: %s\n", engine);
+		fprintf(stderr, "Must be 'decoded', 'threaded', 'block' or 'jit'\n");
+		return 1;
+	}
+
+	if (jobs) {	/* Each job gets a machine of its own */
+		pdp8_destroy(M);
+		if (!nthreads && (nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			nthreads = 1;
+		return batch(jobs, nthreads, results, kwords, engine);
+	}
+
+	if (snapshot && pdp8_restore(M, snapshot)) {
+		fprintf(stderr, "Could not restore '%s'\n", snapshot);
+		return 1;
+	}
+
 	printf("\nPDP-8 simulator version %d.%d\n",MAJVER,MINVER);
 	printf("%ldK memory\n", kwords);
 
-	cpu_init(kwords);
-
 	console();
 
-	cpu_deinit();
+	pdp8_destroy(M);
+	log_close();
 
 	return 0;
 }
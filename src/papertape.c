@@ -2,20 +2,29 @@
 #include <sys/errno.h>
 
 #include "pdp8.h"
+#include "event.h"
 #include "log.h"
 #include "papertape.h"
 
-static int ppt_ien;
+// The reader and punch of the current machine
+#define ppt_ien         (M->st.ppt_ien)
 
-static FILE* reader_fp;
-static int   reader_eot;
-static int   reader_flag;
-static int   reader_buffer;
+#define reader_fp       (M->reader_fp)
+#define reader_eot      (M->st.reader_eot)
+#define reader_flag     (M->st.reader_flag)
+#define reader_buffer   (M->st.reader_buffer)
 
-static FILE* punch_fp;
-static int   punch_flag;
+#define punch_fp        (M->punch_fp)
+#define punch_flag      (M->st.punch_flag)
+
+#define PPT_ERROR       (-2)    // Read error, not the end of tape
+
+// Instructions to read/punch a character, by dev_rate
+static const unsigned long reader_delay[] = { 0, CPS_DELAY(10), CPS_DELAY(300) };
+static const unsigned long punch_delay[] = { 0, CPS_DELAY(10), CPS_DELAY(50) };
 
 static void ppt_reader_read(void);
+static void ppt_punch_done(void);
 static void ppt_punch_write(int ch);
 
 void ppt_init(void)
@@ -29,6 +38,23 @@ void ppt_init(void)
 
     punch_fp = 0;
     punch_flag = 0;
+
+    ev_handler(EV_PPT_READER, ppt_reader_read);
+    ev_handler(EV_PPT_PUNCH, ppt_punch_done);
+}
+
+// Close the files assigned to the reader and punch
+void ppt_exit(void)
+{
+    if (reader_fp) {
+        fclose(reader_fp);
+        reader_fp = 0;
+    }
+    if (punch_fp) {
+        if (fclose(punch_fp))
+            log_error(errno, "fclose");
+        punch_fp = 0;
+    }
 }
 
 //
@@ -84,16 +110,18 @@ int  ppt_reader_get_buffer(void)
 // Initiate the reading of the next character from tape
 void ppt_reader_clear_flag(void)
 {
-    ppt_reader_read();
+    reader_flag = 0;
+    cpu_ireq(PPT_READER, 0);
+    ev_schedule(EV_PPT_READER, reader_delay[dev_rate]);
 }
 
-// Try to read 1 character into the buffer
+// Try to read 1 character into the buffer (event)
 // Set reader flag according to success/failure
 static void ppt_reader_read(void)
 {
 	int ch;
 
-    if (reader_fp == NULL) {
+    if (reader_fp == NULL && !M->reader_fn) {
         printf("There's no file assigned to the paper tape reader\r\n");
         return;
     }
@@ -105,17 +133,29 @@ static void ppt_reader_read(void)
         return;
     }
 
-	if ((ch = fgetc(reader_fp)) != EOF) {
+    if (M->rev && (ch = rev_input(REV_READER)) != REV_LIVE)
+        ;                               // Read already (see rev.c)
+    else {
+        if (M->reader_fn) {             // Callback, -1 at end of tape
+            if ((ch = (*M->reader_fn)(M->reader_ctx)) < 0)
+                ch = -1;
+        } else if ((ch = fgetc(reader_fp)) < 0 && !feof(reader_fp)) {
+            log_error(errno, "fgetc");
+            ch = PPT_ERROR;
+        }
+        if (M->rev)
+            rev_record(REV_READER, ch);
+    }
+
+    if (ch >= 0) {
         // We have a character
 		reader_flag = 1;
         reader_buffer = ch == 10 ? 13 : ch; // \n --> \r
-	} else {		                    // EOF or error
+	} else {		                    // End of tape or error
         // No character
     	reader_flag = 0;
-        if (feof(reader_fp))
+        if (ch != PPT_ERROR)
             reader_eot = 1;
-	    else
-		    log_error(errno, "fgetc");
     }
 
     if (HAVE_IOMEC_PPT) {
@@ -166,16 +206,33 @@ void ppt_punch_putchar(int ch)
 }
 
 // Put character into tape
-// Set punch_flag if success
+// Set punch_flag if success, when the punch is done
 static void ppt_punch_write(int ch)
 {
+    if (M->rev && rev_quiet() && (M->punch_fn || punch_fp)) {
+        ev_schedule(EV_PPT_PUNCH, punch_delay[dev_rate]);   // Punched already (see rev.c)
+        return;
+    }
+
+    if (M->punch_fn) {
+        (*M->punch_fn)(M->punch_ctx, ch);
+        ev_schedule(EV_PPT_PUNCH, punch_delay[dev_rate]);
+        return;
+    }
+
     if (punch_fp == NULL) {
         printf("There's no file assigned to the paper tape punch\r\n");
         return;
     }
 
     if (fputc(ch, punch_fp) != EOF)
-        punch_flag = 1;
+        ev_schedule(EV_PPT_PUNCH, punch_delay[dev_rate]);
     else
         log_error(errno, "fputc");
 }
+
+// The character has been punched (event)
+static void ppt_punch_done(void)
+{
+    punch_flag = 1;
+}
@@ -3,6 +3,7 @@
 
 
 extern void ppt_init(void);
+extern void ppt_exit(void);
 
 extern void ppt_reader_punch_ien(int onoff);
 extern void ppt_reader_assign(char* fname);
@@ -9,6 +9,11 @@ typedef unsigned int uint;
 typedef unsigned short WORD;
 typedef unsigned char BIT;
 
+#include <signal.h>
+
+#include "event.h"
+#include "libpdp8.h"
+
 #define	WORD_BITS		12
 #define	WORD_MASK		((1 << WORD_BITS) - 1)
 #define	BYTE_BITS		6
@@ -85,46 +90,348 @@ typedef unsigned char BIT;
 #define	FIELD_SHFT	WORD_BITS
 #define	PAGE_SHFT	7
 
-/* CPU state */
-extern WORD AC;		/* Accumulator */
-extern WORD L;		/* Link */
-extern WORD MQ;		/* Multiplier/Quotient register */
-extern WORD SC;		/* Step counter (5 bits) */
-extern WORD PC;		/* Program counter */
-extern WORD SR;		/* Switch register */
-extern WORD IR;		/* Instruction register (12 bits) */
-extern WORD MA;		/* Memory address register */
-extern WORD MB;		/* Memory buffer register */
-
-/* Memory extension registers */
-extern WORD IF;		/* Instruction field (I0000) */
-extern WORD DF;		/* Data field (D0000) */
-extern WORD IB;		/* Instruction buffer (I0000) */
-extern WORD SF;		/* Save field (00ID) */
-
-/* Various flip-flops */
-extern BIT RUN;		/* CPU is running */
-extern BIT STOP;	/* CTRL-C was pressed */
-extern BIT IEN;		/* Interrupt enable */
-extern BIT ION_delay;/* Delay ION by 1 instruction */
-extern BIT CIF_delay;/* Delay ION until next JMP/JMS */
-
-extern unsigned long long IREQ;	/* Interrupt request */
-
-extern WORD trace;	// Trace execution?
-extern WORD BP_NUM;	// Active breakpoint number
-extern WORD THISPC;	// Current PC before it's incremented
-
-/* Configuration */
-extern BIT HAVE_EAE;		// Extended arithmetic element
-extern BIT HAVE_EMEM;		// Extended memory (> 4K)
-extern BIT HAVE_IOMEC_PPT;	// IOmec paper tape reader/punch 
+/*
+   1 if cpu_attention() has nothing to do after each of the next n
+   instructions, provided they don't call cpu_request(). Those are
+   then counted with CPU_COUNT().
+*/
+#define	CPU_QUIET(n)	(cpu_countdown > (n))
+#define	CPU_COUNT(n)	(cpu_countdown -= (n))
+
+/* Execution engines */
+#define	ENGINE_DECODED	0	/* Predecoded instructions (default) */
+#define	ENGINE_THREADED	1	/* Threaded code, see pdp8thr.c */
+#define	ENGINE_BLOCK	2	/* Basic blocks, see pdp8blk.c */
+#define	ENGINE_JIT		3	/* Basic blocks + native code, see pdp8jit.c */
 
+/* Device rates (pdp8_rate) */
+#define	RATE_MAX		0	/* Unthrottled, devices are done at once (default) */
+#define	RATE_ASR33		1	/* ASR-33: keyboard, printer, reader and punch 10 cps */
+#define	RATE_HIGHSPEED	2	/* ASR-33 + high-speed reader 300 cps and punch 50 cps */
+
+#define	INSTR_NS		1500	/* Time of an instruction (ns) */
+#define	CPS_DELAY(cps)	(1000000000UL / ((cps) * INSTR_NS))	/* Instructions per char */
 
 /* Primary memory */
 #define	MAXMEM	4096	/* 4K words */
-extern size_t memwords;
-extern WORD *MP;
+
+/*
+   Predecoded instructions, one per memory word (parallel to MP).
+   An entry whose handler is cpu_decode() has not been decoded yet
+   (or was invalidated by a store) and is decoded on first execution.
+*/
+typedef struct decoded DECODED;
+struct decoded {
+	void (*exec)(DECODED *d);	/* Instruction handler */
+	WORD ea;					/* Direct effective address (no field) */
+	WORD flags;					/* D_xxx below */
+	WORD inst;					/* Instruction word */
+};
+
+#define	D_INDIRECT	0001		/* Indirect addressing */
+#define	D_AUTOINC	0002		/* Indirect through 0010-0017 */
+
+/*
+   Memory tags, one per word (parallel to MP). A tagged word has
+   something else depending on its contents, which must be told
+   when it is stored into (see cpu_store_tagged).
+*/
+#define	T_FUSED		0001		/* Fused into the previous instruction */
+#define	T_BLOCK		0002		/* Covered by a translated block */
+#define	T_BREAK		0004		/* Has a breakpoint (see break.c) */
+#define	T_WATCHR	0010		/* Watched for reads (see watch.c) */
+#define	T_WATCHW	0020		/* Watched for writes */
+#define	T_WATCH		(T_WATCHR | T_WATCHW)
+#define	T_REV		0040		/* Page not stored into since the last snapshot (see rev.c) */
+#define	T_KEEP		(T_BREAK | T_WATCH)	/* Not derived from the contents */
+
+/*
+   Machine
+
+   Everything a simulated PDP-8 is made of: registers, memory, the
+   state of the engines and of the devices. The simulator works on
+   the machine pointed to by M (see libpdp8.c), and the names used
+   all over it for registers and memory are macros for its fields.
+   Each module keeps its own fields private the same way.
+
+   The values that make up the state of the machine, as opposed to
+   pointers, caches and host resources, are kept together in a STATE,
+   which is what a snapshot saves along with MP (see snapshot.c).
+*/
+typedef struct {
+	/* CPU state */
+	WORD ac;		/* Accumulator */
+	WORD l;			/* Link */
+	WORD mq;		/* Multiplier/Quotient register */
+	WORD sc;		/* Step counter (5 bits) */
+	WORD pc;		/* Program counter */
+	WORD sr;		/* Switch register */
+	WORD ir;		/* Instruction register (12 bits) */
+	WORD ma;		/* Memory address register */
+	WORD mb;		/* Memory buffer register */
+
+	/* Memory extension registers */
+	WORD if_;		/* Instruction field (I0000) */
+	WORD df;		/* Data field (D0000) */
+	WORD ib;		/* Instruction buffer (I0000) */
+	WORD sf;		/* Save field (00ID) */
+
+	/* Various flip-flops */
+	BIT run;		/* CPU is running */
+	volatile sig_atomic_t stop;	/* CTRL-C was pressed (set by a signal handler) */
+	BIT ien;		/* Interrupt enable */
+	BIT ion_delay;	/* Delay ION by 1 instruction */
+	BIT cif_delay;	/* Delay ION until next JMP/JMS */
+
+	unsigned long long ireq;	/* Interrupt request, 1 bit per device */
+
+	WORD thispc;	/* Current PC before it's incremented */
+
+	/* Configuration */
+	BIT have_eae;		/* Extended arithmetic element */
+	BIT have_emem;		/* Extended memory (> 4K) */
+	BIT have_iomec_ppt;	/* IOmec paper tape reader/punch */
+
+	/* Attention and time (pdp8cpu.c) */
+	int countdown;		/* Instructions before cpu_attention() */
+	int countdown_len;	/* Value it was set to */
+	unsigned long long cycles;	/* Time when it was set */
+
+	/* Event queue (event.c) */
+	EVENT events[EV_MAX];
+	int ev_heap[EV_MAX];
+	int ev_nheap;
+
+	/* Keyboard and teleprinter (tty.c) */
+	char keyb_buffer;
+	int keyb_flag;		/* 1 if keyb_buffer has a valid char */
+	int tty_flag;		/* 1 if teleprinter is done outputing a character */
+	int tty_dev;		/* Device of the character being printed */
+	unsigned long long keyb_due;	/* Time the next key can be read */
+
+	/* Paper tape reader and punch (papertape.c) */
+	int ppt_ien;
+	int reader_eot;
+	int reader_flag;
+	int reader_buffer;
+	int punch_flag;
+} STATE;
+
+/* Instruction mix, counted while stats is on */
+#define	MODE_ZERO		0	/* Direct, page 0 */
+#define	MODE_CURRENT	1	/* Direct, current page */
+#define	MODE_IND_ZERO	2	/* Indirect through page 0 (not auto-index) */
+#define	MODE_IND_CUR	3	/* Indirect through the current page */
+#define	MODE_AUTO		4	/* Indirect through 0010-0017 */
+#define	MODES			5
+
+typedef struct {
+	unsigned long long op[8];		/* By opcode */
+	unsigned long long opr[3];		/* OPR by group (1, 2, 3) */
+	unsigned long long mode[MODES];	/* Memory references by addressing mode */
+	unsigned long long iot[01000];	/* IOT by device and function */
+} STATS;
+
+/*
+   Instruction history: the last instructions executed, recorded by
+   every engine with HIST_ADD() right after each one, whatever else is
+   on. Its size is a power of 2 (see cpu_history).
+*/
+#define	HIST_SIZE	65536		/* Instructions kept by default */
+#define	HIST_MAX	(1 << 24)	/* At most */
+
+typedef struct {
+	WORD pc;		/* Address of the instruction (15 bits) */
+	WORD ir;
+	WORD ac, l, mq;	/* After it */
+	WORD ma;		/* Effective address (memory reference instructions) */
+} HIST;
+
+/* Breakpoints (break.c) */
+#define	BRK_AC		0001	/* Stop only if AC == ac */
+#define	BRK_L		0002	/* Stop only if L == l */
+#define	BRK_DF		0004	/* Stop only if DF == df */
+
+typedef struct {
+	int used;			/* 0=free slot */
+	WORD addr;			/* 15 bits */
+	WORD cond;			/* BRK_xxx */
+	WORD ac, l, df;		/* Values for the conditions (df 0-7) */
+	unsigned long skip;	/* Hits before it stops */
+	unsigned long hits;	/* Times reached with the conditions true */
+} BREAK;
+
+/* Watchpoints (watch.c) */
+#define	WATCH_R		0001	/* On reads */
+#define	WATCH_W		0002	/* On writes */
+#define	WATCH_LOG	0004	/* Only report through on_watch, don't stop */
+#define	WATCH_STORES	4	/* Max stores by one instruction (and an interrupt) */
+
+typedef struct {
+	int used;			/* 0=free slot */
+	WORD addr;			/* First word (15 bits) */
+	WORD len;			/* # of words */
+	WORD mode;			/* WATCH_xxx */
+	unsigned long hits;	/* Accesses */
+} WATCH;
+
+#define	KEYB_RING	256		/* Keyboard input read ahead (power of 2) */
+#define	TTY_RING	4096	/* Teleprinter output not written yet (power of 2) */
+
+struct pdp8 {
+	STATE st;
+
+	WORD bp_num;	/* Breakpoint the CPU stopped at (0=none) */
+	BREAK *bp_table;	/* Breakpoints (break.c) */
+	int bp_slots;		/* Size of bp_table */
+	int bp_count;		/* Breakpoints set */
+	WATCH *watch_table;	/* Watchpoints (watch.c) */
+	int watch_slots;	/* Size of watch_table */
+	int watch_count;	/* Watchpoints set */
+	int watch_num;		/* Watchpoint the CPU stopped at (0=none) */
+	WORD watch_addr;	/* The access that stopped it */
+	int watch_write;	/* 1 if a write */
+	WORD watch_store[WATCH_STORES];	/* Watched words stored into by the instruction */
+	int watch_stores;
+	struct reverse *rev;	/* Reverse execution (rev.c), 0=off */
+	int rev_due;		/* A snapshot is due */
+	WORD trace;		/* Trace execution? */
+	struct trace_hdr *trace_hdr;	/* Binary trace file mapped (trace.c) */
+	struct trace_rec *trace_rec;	/* Its records */
+	size_t trace_size;
+	int trace_fd;
+	int profile;	/* Count executions in prof_count? */
+	unsigned long long *prof_count;	/* Executions per address (memwords) */
+	int stats;		/* Count the instruction mix in stats_count? */
+	STATS stats_count;
+	HIST *hist;		/* Instruction history, a ring */
+	unsigned hist_pos;	/* Instructions recorded (next one & hist_mask) */
+	unsigned hist_mask;	/* Its size - 1 */
+	void (*on_trace)(WORD addr, WORD code);	/* Trace an instruction */
+	void (*on_stop)(void);					/* Stopped by CTRL-C */
+	void (*on_watch)(int n, WORD addr, int write);	/* Logging watchpoint n hit */
+	int engine;		/* Execution engine */
+	int rate;		/* Device rate */
+
+	/* Memory */
+	size_t memwords;	/* # of words */
+	int nfields;		/* # of fields */
+	WORD *mp;			/* Primary memory */
+	DECODED *dc;		/* Predecoded instructions */
+	unsigned char *mt;	/* Memory tags */
+
+	EVENT_FN ev_fn[EV_MAX];	/* Event handlers (event.c) */
+	unsigned ev_fired;		/* # of events run */
+
+	/* Idle loop detection (pdp8cpu.c) */
+	WORD idle_pc;		/* JMP that last closed a short loop */
+	WORD idle_bad;		/* Last one found not to be an idle loop */
+	unsigned long long idle_time;	/* When it did */
+	unsigned idle_fired;			/* ev_fired then */
+	WORD idle_ac, idle_l, idle_mq, idle_df;	/* Registers then */
+
+	/* Basic blocks (pdp8blk.c) and native code (pdp8jit.c) */
+	struct block **blocks;
+	unsigned char *jit_buf;
+	size_t jit_pos;
+	unsigned jit_gen;
+
+	/* Keyboard and teleprinter (tty.c) */
+	int keyb_fd;		/* Keyboard file descriptor (-1=none) */
+	int keyb_real;		/* 1 if real keyboard, 0 if other file */
+	unsigned char keyb_ring[KEYB_RING];	/* Input read ahead */
+	unsigned keyb_head, keyb_tail;		/* Next in, next out */
+	int tty_sync;		/* 1 if each character is written at once */
+	unsigned char tty_ring[TTY_RING];	/* Output buffered */
+	unsigned tty_head, tty_tail;		/* Next in, next out */
+	PDP8_INPUT keyb_fn;	/* Callbacks (0=use the host) */
+	void *keyb_ctx;
+	PDP8_OUTPUT tty_fn;
+	void *tty_ctx;
+
+	/* Paper tape reader and punch (papertape.c) */
+	FILE *reader_fp;
+	FILE *punch_fp;
+	PDP8_INPUT reader_fn;	/* Callbacks (0=use the files) */
+	void *reader_ctx;
+	PDP8_OUTPUT punch_fn;
+	void *punch_ctx;
+};
+
+/* Each thread has its own current machine */
+#ifdef __GNUC__
+#define	THREAD_LOCAL	__thread
+#else
+#define	THREAD_LOCAL	_Thread_local
+#endif
+
+extern THREAD_LOCAL PDP8 *M;	/* Current machine */
+
+/* CPU state */
+#define	AC			(M->st.ac)
+#define	L			(M->st.l)
+#define	MQ			(M->st.mq)
+#define	SC			(M->st.sc)
+#define	PC			(M->st.pc)
+#define	SR			(M->st.sr)
+#define	IR			(M->st.ir)
+#define	MA			(M->st.ma)
+#define	MB			(M->st.mb)
+
+#define	IF			(M->st.if_)
+#define	DF			(M->st.df)
+#define	IB			(M->st.ib)
+#define	SF			(M->st.sf)
+
+#define	RUN			(M->st.run)
+#define	STOP		(M->st.stop)
+#define	IEN			(M->st.ien)
+#define	ION_delay	(M->st.ion_delay)
+#define	CIF_delay	(M->st.cif_delay)
+
+#define	IREQ		(M->st.ireq)
+#define	cpu_countdown	(M->st.countdown)
+
+#define	trace		(M->trace)
+#define	BP_NUM		(M->bp_num)
+#define	BP_COUNT	(M->bp_count)
+#define	WATCH_NUM	(M->watch_num)
+#define	WATCH_COUNT	(M->watch_count)
+#define	THISPC		(M->st.thispc)
+
+#define	HAVE_EAE		(M->st.have_eae)
+#define	HAVE_EMEM		(M->st.have_emem)
+#define	HAVE_IOMEC_PPT	(M->st.have_iomec_ppt)
+#define	cpu_engine		(M->engine)
+#define	profile			(M->profile)
+#define	prof_count		(M->prof_count)
+#define	stats			(M->stats)
+#define	stats_count		(M->stats_count)
+#define	dev_rate		(M->rate)
+
+#define	memwords	(M->memwords)
+#define	nfields		(M->nfields)
+#define	MP			(M->mp)
+#define	DC			(M->dc)
+#define	MT			(M->mt)
+
+/* Store into memory and invalidate the predecoded instruction */
+#define	MEM_STORE(a,v)	do { \
+	MP[a] = (v); \
+	DC[a].exec = cpu_decode; \
+	if (MT[a]) cpu_store_tagged(a); \
+} while (0)
+
+/* Record the instruction i at a, just executed, in the history */
+#define	HIST_ADD(a,i)	do { \
+	HIST *h_ = &M->hist[M->hist_pos++ & M->hist_mask]; \
+	h_->pc = (a); \
+	h_->ir = (i); \
+	h_->ac = AC; \
+	h_->l = L; \
+	h_->mq = MQ; \
+	h_->ma = MA; \
+} while (0)
 
 /* Used by the disassembler to represent an instruction */
 typedef struct {
@@ -139,17 +446,92 @@ typedef struct {
 /* Implemented by pdp8cpu.c */
 extern void	cpu_init(size_t kwords);
 extern void cpu_deinit(void);
-extern void	cpu_run(WORD addr, WORD count);
+extern void	cpu_decode(DECODED *d);
+extern void	cpu_decode_op(DECODED *d, WORD addr, WORD inst);
+extern int	cpu_history(unsigned long n);
+extern void	cpu_attention(void);
+extern void	cpu_iot(void);
+extern void	cpu_jmp(void);
+extern void	cpu_jms(void);
+extern void	cpu_operate(void);
+extern void	cpu_replay(unsigned long count);
+extern void	cpu_request(void);
+extern void	cpu_run(WORD addr, unsigned long count);
+extern void	cpu_step(void);
+extern unsigned long long cpu_time(void);
+extern void	cpu_store_tagged(WORD addr);
 extern void cpu_ireq(int dev, int updown);
 extern void log_close(void);
 extern void log_open(void);
 
+/* Implemented by pdp8opr.c */
+extern void (*const opr1_table[256])(DECODED *d);
+extern void (*const opr2_table[128])(DECODED *d);
+
+/* Implemented by pdp8thr.c */
+extern void	cpu_run_threaded(void);
+
+/* Implemented by pdp8blk.c */
+extern void	blk_free(void);
+extern void	blk_invalidate(WORD addr);
+extern void	cpu_run_blocks(void);
+
+/* Implemented by pdp8jit.c */
+typedef int (*JITCODE)(void);	/* Returns # of instructions executed */
+#define	jit_gen		(M->jit_gen)
+extern int	jit_available(void);
+extern JITCODE	jit_compile(WORD addr, DECODED *op, int n, WORD *len);
+extern void	jit_free(void);
+
+/* Implemented by break.c */
+extern int	brk_set(const BREAK *b);
+extern BREAK *brk_get(int n);
+extern int	brk_at(WORD addr);
+extern int	brk_clear(int n);
+extern int	brk_stop(void);
+
+/* Implemented by watch.c */
+extern int	watch_set(const WATCH *w);
+extern WATCH *watch_get(int n);
+extern int	watch_clear(int n);
+extern void	watch_store(WORD addr);
+extern int	watch_check(void);
+
+/* Implemented by rev.c */
+#define	REV_INTERVAL	100000	/* Instructions between snapshots by default */
+#define	REV_KEYB		1		/* Inputs logged */
+#define	REV_READER		2
+#define	REV_LIVE		(-0400)	/* From rev_input(): take it from the host */
+extern int	rev_back(unsigned long long time);
+extern int	rev_continue(void);
+extern void	rev_init(void);
+extern int	rev_input(int kind);
+extern int	rev_quiet(void);
+extern void	rev_record(int kind, int value);
+extern void	rev_reset(void);
+extern void	rev_snap(void);
+extern int	rev_start(unsigned long interval);
+extern int	rev_status(unsigned long *interval, unsigned long long *oldest);
+extern void	rev_stopped(void);
+extern void	rev_store(WORD addr);
+
+/* Implemented by trace.c */
+extern void	trace_write(void);
+extern int	trace_close(void);
+
 /* Implemented by pdp8asm.c */
 extern void	cpu_disasm(DINSTR *pi);
+#define	FILEFMT_ASM		1	// macro-8 assembler source
+#define	FILEFMT_BIN		2
+#define	FILEFMT_RIM		3
+#define	FILEFMT_TXT		4	// Text version of RIM: <addr> <code>
+
 extern int	load_asm(FILE *inp, FILE *out, FILE *err);
 extern int	load_bin(FILE *inp, FILE *out, FILE *err);
 extern int	load_rim(FILE *inp, FILE *out, FILE *err);
 extern int	load_txt(FILE *inp, FILE *out, FILE *err);
+extern int	load_file(FILE *inp, int ffmt, FILE *out, FILE *err);
+extern int	load_format(const char *fname);
 
 #ifdef __GNUC__
 #define UNUSED __attribute__((__unused__))
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <assert.h>
@@ -468,7 +469,7 @@ void asm_emit_lits(FILE *out, PAGETAB *pt)
 			fprintf(out, "%04o %04o\n", addr, table[MAXLITS - i]);
 	} else {
 		for (int i = nlits; i >= 1; --i, ++addr)
-			MP[addr] = table[MAXLITS - i];
+			MEM_STORE(addr, table[MAXLITS - i]);
 	}
 }
 
@@ -678,7 +679,7 @@ void asm_line(FILE *out, FILE *err)
 	if (gencode) {
 		if (pass == 2) {
 			if (out) fprintf(out, "%04o %04o\n", clc, code);
-			else MP[clc] = (WORD)code;
+			else MEM_STORE(clc, (WORD)code);
 		}
 		++clc;
 	}
@@ -833,7 +834,7 @@ int load_bin(FILE *inp, FILE *out, FILE *err)
 					addr, code, inst.ascii, inst.name, inst.args);
 			}
 	
-			MP[addr] = code;
+			MEM_STORE(addr, code);
 			++addr;
 			++nlocs;
 		}
@@ -890,7 +891,7 @@ int load_rim(FILE *inp, FILE *out, FILE *err)
 				addr, code, inst.ascii, inst.name, inst.args);
 		}
 
-		MP[addr] = code;
+		MEM_STORE(addr, code);
 		if (addr < first) first = addr;
 		if (addr > last) last = addr;
 		++nlocs;
@@ -937,7 +938,7 @@ int load_txt(FILE *inp, UNUSED FILE *out, FILE *err)
 		}
 		if (addr < first) first = addr;
 		if (addr > last) last = addr;
-		MP[addr] = data;
+		MEM_STORE(addr, data);
 	}
 
 	fprintf(err, "Read %d locations\n", nlines);
@@ -946,6 +947,51 @@ int load_txt(FILE *inp, UNUSED FILE *out, FILE *err)
 	return 0;
 }
 
+/*
+   Return the format of a file from its name (FILEFMT_xxx), or 0.
+	name.asm8				assembler source
+	name.bin, name.pb, name-pb	BIN
+	name.rim, name.pm, name-pm	RIM
+	name.txt				text
+*/
+int load_format(const char *fname)
+{
+	const char *sep;
+
+	if ((sep = strrchr(fname, '.')) && strlen(sep+1) < 5) {
+		if (!strcasecmp(sep+1,"asm8"))
+			return FILEFMT_ASM;
+		if (!strcasecmp(sep+1,"bin") || !strcasecmp(sep+1,"pb"))
+			return FILEFMT_BIN;
+		if (!strcasecmp(sep+1,"rim") || !strcasecmp(sep+1,"pm"))
+			return FILEFMT_RIM;
+		if (!strcasecmp(sep+1,"txt"))
+			return FILEFMT_TXT;
+	} else if ((sep = strrchr(fname, '-'))) {
+		if (!strcasecmp(sep+1,"pb"))
+			return FILEFMT_BIN;
+		if (!strcasecmp(sep+1,"pm"))
+			return FILEFMT_RIM;
+	}
+	return 0;
+}
+
+/* Load inp in format ffmt, disassembling to out if not 0 */
+int load_file(FILE *inp, int ffmt, FILE *out, FILE *err)
+{
+	switch (ffmt) {
+	case FILEFMT_ASM:
+		return load_asm(inp,out,err);
+	case FILEFMT_BIN:
+		return load_bin(inp,out,err);
+	case FILEFMT_RIM:
+		return load_rim(inp,out,err);
+	case FILEFMT_TXT:
+		return load_txt(inp,out,err);
+	}
+	return -1;
+}
+
 static int symb_hash(int len, char *pnt)
 {
 	int hash = 0;
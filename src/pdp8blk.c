@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdp8.h"
+
+/*
+   Basic-block execution engine (selected with "-e block")
+
+   Straight-line runs of instructions are translated once into an
+   array of DECODED entries (a block) and then executed by a tight
+   loop over the array, without fetching from MP or checking for
+   breakpoints, trace, CTRL-C, count and interrupts after each one.
+   A block ends with (and includes) the first instruction that may
+   change the PC or the interrupt system: JMP, JMS, ISZ, IOT, group 2
+   OPR with a skip or HLT, and the EAE instructions other than the
+   register transfers (MQL, MQA, SWP, SCA, CAM...), which may read
+   their operand from the next word. It also ends at the last word of a field and after
+   BLK_MAX instructions.
+
+   Blocks are cached by their starting address (field included) and
+   remember the block executed after them, one for the fall through
+   and one for any other exit (jump or skip), so that a running loop
+   goes from block to block without looking anything up.
+
+   cpu_attention() is called at most once per block, after its last
+   instruction. A block is entered only if the countdown won't reach
+   0 before the last one (see CPU_QUIET). Otherwise the engine
+   executes one instruction at a time with cpu_step() until it can
+   enter blocks again, so traces, breakpoints, counts and interrupts
+   happen at the same instructions as with the other engines.
+
+   Every word covered by a block is tagged T_BLOCK, and a store into
+   it invalidates all the blocks covering it (see blk_invalidate).
+   If a block overwrites one of its own instructions it stops right
+   after the store.
+
+   With "-e jit" the blocks entered JIT_THRESHOLD times get native
+   code for all their instructions but the last (see pdp8jit.c).
+*/
+
+#define	BLK_MAX		32	/* Max instructions in a block */
+#ifndef	JIT_THRESHOLD
+#define	JIT_THRESHOLD	64	/* Entries before compiling a block */
+#endif
+
+typedef struct block BLOCK;
+struct block {
+	WORD start;			/* Address of the first instruction */
+	WORD len;			/* # of instructions (0=must be translated) */
+	BLOCK *next[2];		/* Last successor: fall through, other */
+	DECODED *op;		/* Translated instructions */
+	uint hits;			/* Times entered (JIT only) */
+	JITCODE code;		/* Native code for op[0..len-2] (0=none) */
+	unsigned gen;		/* jit_gen of code */
+	WORD code_if;		/* IF and DF code was compiled for */
+	WORD code_df;
+};
+
+#define	blocks	(M->blocks)	/* Blocks by starting address (0=none yet) */
+
+/* Return 1 if the instruction i ends a block */
+static int blk_ends(WORD i)
+{
+	switch (i >> 9) {
+	case 2:	/* ISZ */
+	case 4:	/* JMS */
+	case 5:	/* JMP */
+	case 6:	/* IOT */
+		return 1;
+	case 7:	/* OPR */
+		if (!(i & GROUP_BIT))			/* Group 1 */
+			return 0;
+		if (!(i & 1))					/* Group 2 */
+			return (i & 00172) != 0;	/* Skip or HLT */
+		if (i & 00016)					/* EAE with operand */
+			return 1;
+		switch ((i >> 4) & 07) {		/* Register transfers */
+		case 3: case 6: case 7:			/* Invalid */
+			return 1;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+/* Translate the instructions starting at b->start */
+static void blk_translate(BLOCK *b)
+{
+	DECODED op[BLK_MAX];
+	WORD addr = b->start;
+	int n = 0;
+
+	for (;;) {
+		cpu_decode_op(&op[n++], addr, MP[addr]);
+		MT[addr] |= T_BLOCK;
+		if (blk_ends(MP[addr]) || n == BLK_MAX
+			|| (addr & WORD_MASK) == WORD_MASK)
+			break;
+		++addr;
+	}
+
+	b->op = realloc(b->op, n * sizeof(DECODED));
+	memcpy(b->op, op, n * sizeof(DECODED));
+	b->len = n;
+	b->hits = 0;
+	b->code = 0;
+}
+
+/* Compile b for the current fields if it has anything to compile */
+static void blk_compile(BLOCK *b)
+{
+	if (b->len < 3)
+		return;
+	b->code = jit_compile(b->start, b->op, b->len - 1, &b->len);
+	b->gen = jit_gen;
+	b->code_if = IF;
+	b->code_df = DF;
+}
+
+/* Return the block starting at addr, translating it if needed */
+static BLOCK *blk_lookup(WORD addr)
+{
+	BLOCK *b = blocks[addr];
+
+	if (!b) {
+		b = calloc(1, sizeof(BLOCK));
+		b->start = addr;
+		blocks[addr] = b;
+	}
+	if (!b->len)
+		blk_translate(b);
+	return b;
+}
+
+/* Invalidate the blocks covering the word at addr */
+void blk_invalidate(WORD addr)
+{
+	WORD first = addr & FIELD_MASK;	/* Blocks don't cross fields */
+	WORD a = addr;
+	BLOCK *b;
+
+	for (;;) {
+		if ((b = blocks[a]) && a + b->len > addr)
+			b->len = 0;
+		if (a == first || addr - a == BLK_MAX - 1)
+			break;
+		--a;
+	}
+}
+
+/* Free all the blocks */
+void blk_free(void)
+{
+	size_t a;
+
+	if (!blocks)
+		return;
+	for (a = 0; a < memwords; ++a) {
+		if (blocks[a]) {
+			free(blocks[a]->op);
+			free(blocks[a]);
+		}
+	}
+	free(blocks);
+	blocks = 0;
+}
+
+void cpu_run_blocks(void)
+{
+	BLOCK *b, *nb;
+	DECODED *op, *last;
+	WORD fall;
+	int n;
+
+	if (!blocks)
+		blocks = calloc(memwords, sizeof(BLOCK *));
+
+	b = blk_lookup(PC);
+	while (RUN) {
+		if (!CPU_QUIET(b->len - 1)) {	/* Attention needed */
+			cpu_step();
+			b = blk_lookup(PC);
+			continue;
+		}
+
+		/* All but the last instruction */
+		last = b->op + b->len - 1;
+		if (b->code && b->gen == jit_gen
+			&& b->code_if == IF && b->code_df == DF) {
+			n = (*b->code)();
+		} else {
+			if (b->code) {	/* Compiled for other fields */
+				b->code = 0;
+				b->hits = 0;
+			}
+			if (cpu_engine == ENGINE_JIT && ++b->hits == JIT_THRESHOLD)
+				blk_compile(b);
+			for (op = b->op; op < last; ++op) {
+				(*op->exec)(op);
+				HIST_ADD(b->start + (op - b->op), op->inst);
+				if (!b->len) {	/* Stored into itself */
+					++op;
+					break;
+				}
+			}
+			n = op - b->op;
+		}
+		if (!b->len) {	/* Stop right after the store */
+			op = b->op + n - 1;
+			THISPC = b->start + n - 1;
+			MA = THISPC;
+			IR = MB = op->inst;
+			PC = THISPC + 1;
+			CPU_COUNT(n);
+			if (cpu_countdown <= 0)
+				cpu_attention();
+			b = blk_lookup(PC);
+			continue;
+		}
+
+		/* The last one, with the registers set as by a fetch */
+		THISPC = b->start + n;
+		MA = THISPC;
+		IR = MB = last->inst;
+		PC = THISPC;
+		PC_INC();
+		CPU_COUNT(n);
+		(*last->exec)(last);
+		HIST_ADD(THISPC, IR);
+		if (--cpu_countdown <= 0)
+			cpu_attention();
+
+		/* Chain to the next block */
+		fall = (b->start & FIELD_MASK) | ((THISPC + 1) & WORD_MASK);
+		nb = b->next[PC != fall];
+		if (!nb || nb->start != PC || !nb->len) {
+			nb = blk_lookup(PC);
+			b->next[PC != fall] = nb;
+		}
+		b = nb;
+	}
+}
@@ -3,208 +3,727 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 
 #include "pdp8.h"
-#include "console.h"
+#include "event.h"
 #include "log.h"
 #include "papertape.h"
 #include "tty.h"
 
-// CPU state
-WORD AC;	// Accumulator
-WORD L;		// Link
-WORD MQ;	// Multiplier/Quotient register
-WORD SC;	// Step counter (5 bits)
-WORD PC;	// Program counter
-WORD SR;	// Switch register
-WORD IR;	// Instruction register
-WORD MA;	// Memory address register
-WORD MB;	// Memory buffer register
-
-// Memory extension registers
-WORD IF;	// Instruction field
-WORD DF;	// Data field
-WORD IB;	// Instruction buffer
-WORD SF;	// Save field
-
-// Various flip-flops
-BIT RUN;		// CPU is running
-BIT STOP;		// CTRL-C was pressed
-BIT IEN;		// Interrupt enable
-BIT ION_delay;	// Delay ION by 1 instruction
-BIT CIF_delay;	// Delay ION until next JMP/JMS
-
-// Auxiliary registers 
-WORD THISPC;	// Current PC before it's incremented
-WORD BP_NUM;	// Active breakpoint number
-
-// Interrupt request: 64 bits, 1 bit per device
-unsigned long long IREQ;
-
-WORD trace;	// Trace execution?
-
-/* Configuration */
-BIT HAVE_EAE;		// Extended arithmetic element
-BIT HAVE_EMEM;		// Extended memory (> 4K)
-BIT HAVE_IOMEC_PPT;	// IOmec paper tape reader/punch 
-
-/* Primary memory */
-WORD *MP;
-size_t memwords;/* # of words */
-int nfields;	/* # of fields */
-
-int keyb_delay;
-#define	KEYB_DELAY	1000	// Check keyboard after so many instructions
-
-static void input_output(void);
-static void operate(void);
-static void skip_group(void);
-static void eadd(void);
+/*
+   Attention
+
+   Whatever may have to be done between two instructions (trace,
+   CTRL-C, events, interrupt, delayed ION, watchpoints, breakpoints,
+   snapshots) is done by cpu_attention(). The engines only decrement
+   cpu_countdown after each instruction and call it when it reaches
+   0. The countdown is
+   set to the number of instructions until the next event (end of
+   count, device flags, see event.c), or to 1 while something has to
+   be checked after every instruction (trace, breakpoints, watchpoints,
+   pending interrupt...).
+   Anything that needs attention after the current instruction (ION,
+   HLT, an interrupt request...) calls cpu_request().
+
+   Time is the number of instructions executed since startup.
+*/
+#define	countdown_len	(M->st.countdown_len)	/* Value cpu_countdown was set to */
+#define	cycles			(M->st.cycles)			/* Time when it was set */
+#define	COUNTDOWN_MAX	(1 << 30)
+
+/*
+   Idle loops
+
+   A program waiting for a device usually spins in a short loop that
+   tests flags (KSF, TSF...) or a word set by an interrupt routine,
+   and does nothing else. When a backward JMP closes such a loop, and
+   the registers are the same as when it closed it the last time, with
+   no event in between and nothing stored by the loop, the iteration
+   left the machine as it found it. So will all the next ones, until
+   an event changes a flag or requests an interrupt, and cpu_idle()
+   skips them: time goes forward to the last iteration before the
+   next event, as if they had been executed. If the keyboard is a
+   terminal, the host sleeps meanwhile, until a key is pressed or the
+   next event is due, counting INSTR_NS per instruction.
+*/
+#define	IDLE_SPAN	8		/* Max words in an idle loop */
+#define	IDLE_NONE	0177777	/* No address */
+
+static void run_decoded(void);
+static void run_engine(void);
+static void set_countdown(void);
+
+/* End of the instruction count (event) */
+static void count_done(void)
+{
+	RUN = 0;
+}
 
 void cpu_run(
-	WORD addr,	/* Initial address */
-	WORD count)	/* Number of instructions to run (0=until HLT) */
+	WORD addr,				/* Initial address */
+	unsigned long count)	/* Number of instructions to run (0=until HLT) */
 {
+	BREAK *b = brk_get(BP_NUM);	/* Stopped at */
 
 	PC = addr;
 	RUN = 1;
-	keyb_delay = KEYB_DELAY;
+	BP_NUM = 0;
+	WATCH_NUM = 0;
+	M->watch_stores = 0;
+	/* A breakpoint at addr stops at once, unless it's the one being left */
+	if (BP_COUNT && (MT[PC] & T_BREAK) && !(b && b->addr == PC) && (BP_NUM = brk_stop())) {
+		RUN = 0;
+		return;
+	}
+	countdown_len = cpu_countdown = 0;	/* Time didn't run since */
+	ev_cancel(EV_COUNT);
+	if (count)
+		ev_schedule(EV_COUNT, count);
+	tty_keyb_schedule();
+	M->idle_pc = M->idle_bad = IDLE_NONE;	/* Anything may have changed */
+	if (ION_delay) {	/* Left by the previous run */
+		IEN = 1;
+		ION_delay = 0;
+	}
+	if (M->rev)
+		rev_snap();		/* A replay never goes through this */
+	set_countdown();
 
-	while (RUN) {
-		if (ION_delay) {
-			IEN = 1;	/* Handle interrupts after the next instruction */
-			ION_delay = 0;
-		}
+	run_engine();
+	if (M->rev)
+		rev_stopped();
+	tty_flush();
+}
+
+/*
+   Run count instructions again, from a snapshot restored by rev.c:
+   as cpu_run() without starting a run, which the snapshot comes after.
+*/
+void cpu_replay(unsigned long count)
+{
+	RUN = 1;
+	countdown_len = cpu_countdown = 0;
+	ev_schedule(EV_COUNT, count);
+	set_countdown();
+	run_engine();
+}
 
+/* Run the instructions with the current engine, until RUN is cleared */
+static void run_engine(void)
+{
+	switch (cpu_engine) {
+	case ENGINE_THREADED:
+		cpu_run_threaded();
+		break;
+	case ENGINE_BLOCK:
+	case ENGINE_JIT:
+		cpu_run_blocks();
+		break;
+	default:
+		run_decoded();
+		break;
+	}
+}
+
+/* Main loop dispatching through the predecoded instructions */
+static void run_decoded(void)
+{
+	DECODED *d;
+
+	for (;;) {
 		MA = PC;
 		IR = MB = MP[MA];
 		THISPC = PC;
 		PC_INC();
-		switch (IR >> 9) {	/* Opcode */
-		case 0:	/* AND - Logical AND */
-			eadd();
-			MB = MP[MA];
-			AC &= MB;
-			break;
-		case 1:	/* TAD - Two's complement ADD */
-			eadd();
-			MB = MP[MA];
-			ALU_ADD(AC,MB);
-			break;
-		case 2:	/* ISZ - Increment and skip on zero */
-			eadd();
-			//ALU_INC(MP[MA]);
-			MP[MA] = (MP[MA] + 1) & WORD_MASK;
-			if (!MP[MA]) PC_INC();
-			break;
-		case 3:	/* DCA - Deposit and clear accumulator */
-			eadd();
-			MP[MA] = AC;
-			AC = 0;
+		d = &DC[THISPC];
+		(*d->exec)(d);
+		HIST_ADD(THISPC, IR);
+		if (--cpu_countdown <= 0) {
+			cpu_attention();
+			if (!RUN) return;
+		}
+	}
+}
+
+/* Execute one instruction through its predecoded entry */
+void cpu_step(void)
+{
+	DECODED *d;
+
+	MA = PC;
+	IR = MB = MP[MA];
+	THISPC = PC;
+	PC_INC();
+	d = &DC[THISPC];
+	(*d->exec)(d);
+	HIST_ADD(THISPC, IR);
+	if (--cpu_countdown <= 0)
+		cpu_attention();
+}
+
+/* Current time */
+unsigned long long cpu_time(void)
+{
+	return cycles + (countdown_len - cpu_countdown);
+}
+
+/* Count instruction ir in the instruction mix */
+static void count_stats(WORD ir)
+{
+	int op = ir >> 9;
+
+	++stats_count.op[op];
+	if (op < 6) {		/* Memory reference */
+		if (!(ir & INDIR_BIT))
+			++stats_count.mode[ir & PAGE_BIT ? MODE_CURRENT : MODE_ZERO];
+		else if (ir & PAGE_BIT)
+			++stats_count.mode[MODE_IND_CUR];
+		else if ((ir & 00170) == 00010)
+			++stats_count.mode[MODE_AUTO];
+		else
+			++stats_count.mode[MODE_IND_ZERO];
+	} else if (op == 6)
+		++stats_count.iot[ir & 0777];
+	else if (!(ir & GROUP_BIT))
+		++stats_count.opr[0];
+	else
+		++stats_count.opr[ir & 1 ? 2 : 1];
+}
+
+/* Set the countdown to the next instruction that needs attention */
+static void set_countdown(void)
+{
+	unsigned long long next = ev_next();
+	int n = COUNTDOWN_MAX;
+
+	if (next <= cycles)
+		n = 1;
+	else if (next - cycles < COUNTDOWN_MAX)
+		n = next - cycles;
+	if (BP_COUNT || WATCH_COUNT || trace || profile || stats || STOP || ION_delay
+		|| (IREQ && IEN && !CIF_delay))
+		n = 1;
+	cpu_countdown = countdown_len = n;
+}
+
+/* Have cpu_attention() called after the current instruction */
+void cpu_request(void)
+{
+	cycles += countdown_len - cpu_countdown;
+	cpu_countdown = countdown_len = 0;
+}
+
+/* Called by all the engines when the countdown reaches 0 */
+void cpu_attention(void)
+{
+	cycles += countdown_len - cpu_countdown;
+	countdown_len = cpu_countdown;	/* For cpu_request() from here */
+
+	if (trace) {
+		if (M->trace_hdr)
+			trace_write();
+		else if (M->on_trace)
+			(*M->on_trace)(THISPC, IR);
+	}
+	if (profile)
+		++prof_count[THISPC];
+	if (stats)
+		count_stats(IR);
+	if (STOP) {
+		if (M->on_stop)
+			(*M->on_stop)();
+		RUN = 0;
+		STOP = 0;
+	}
+	ev_run(cycles);
+	if (IREQ && IEN && !ION_delay && !CIF_delay) {
+		/* Service interrupt */
+		/* JMS 0 in field 0 */
+		MEM_STORE(0, PC & WORD_MASK);
+		PC = 1;
+		IEN = 0;
+		SF = (IF >> 9) | (DF >> 12);
+		IF = DF = 0;
+		M->idle_pc = IDLE_NONE;	/* Not an idle loop it comes back to */
+	}
+	if (ION_delay && RUN) {
+		IEN = 1;	/* Handle interrupts after the next instruction */
+		ION_delay = 0;
+	}
+	if (WATCH_COUNT && (WATCH_NUM = watch_check()))
+		RUN = 0;	/* After the instruction that made the access */
+	if (BP_COUNT && RUN && (MT[PC] & T_BREAK) && (BP_NUM = brk_stop()))
+		RUN = 0;	/* Before the instruction at the breakpoint */
+	if (M->rev_due)
+		rev_snap();
+	set_countdown();
+}
+
+/*
+   Instruction handlers
+
+   Each memory word has a DECODED entry holding the handler for the
+   instruction stored there plus its direct effective address, so
+   the opcode switch and the page arithmetic are done only once per
+   store. The handlers are called with IR, THISPC and PC already set.
+*/
+
+/* Follow an indirect pointer (auto-increment 0010-0017) */
+static void indirect(DECODED *d)
+{
+	MA = IF | d->ea;
+	if (d->flags & D_AUTOINC)
+		MEM_STORE(MA, (MP[MA] + 1) & WORD_MASK);
+	MA = DF | MP[MA];
+}
+
+/* AND - Logical AND */
+static void op_and(DECODED *d)
+{
+	MA = IF | d->ea;
+	MB = MP[MA];
+	AC &= MB;
+}
+
+static void op_and_ind(DECODED *d)
+{
+	indirect(d);
+	MB = MP[MA];
+	AC &= MB;
+}
+
+/* TAD - Two's complement ADD */
+static void op_tad(DECODED *d)
+{
+	MA = IF | d->ea;
+	MB = MP[MA];
+	ALU_ADD(AC,MB);
+}
+
+static void op_tad_ind(DECODED *d)
+{
+	indirect(d);
+	MB = MP[MA];
+	ALU_ADD(AC,MB);
+}
+
+/* ISZ - Increment and skip on zero */
+static void op_isz(DECODED *d)
+{
+	MA = IF | d->ea;
+	MEM_STORE(MA, (MP[MA] + 1) & WORD_MASK);
+	if (!MP[MA]) PC_INC();
+}
+
+static void op_isz_ind(DECODED *d)
+{
+	indirect(d);
+	MEM_STORE(MA, (MP[MA] + 1) & WORD_MASK);
+	if (!MP[MA]) PC_INC();
+}
+
+/* DCA - Deposit and clear accumulator */
+static void op_dca(DECODED *d)
+{
+	MA = IF | d->ea;
+	MEM_STORE(MA, AC);
+	AC = 0;
+}
+
+static void op_dca_ind(DECODED *d)
+{
+	indirect(d);
+	MEM_STORE(MA, AC);
+	AC = 0;
+}
+
+/* JMS - Jump to subroutine (MA = target) */
+void cpu_jms(void)
+{
+	IF = IB;
+	MA = IF | (MA & WORD_MASK);
+	MEM_STORE(MA, PC & WORD_MASK);	/* Save return address (12 bits) */
+	PC = MA + 1;					/* Code begins at next word */
+}
+
+static void op_jms(DECODED *d)
+{
+	MA = IF | d->ea;
+	cpu_jms();
+}
+
+static void op_jms_ind(DECODED *d)
+{
+	indirect(d);
+	cpu_jms();
+}
+
+/* Return 1 if the loop PC..THISPC can be idle (see cpu_idle) */
+static int cpu_idle_body(void)
+{
+	WORD a;
+	WORD i;
+	WORD t;
+
+	for (a = PC; a < THISPC; ++a) {
+		i = MP[a];
+		switch (i >> 9) {
+		case 0:	/* AND */
+		case 1:	/* TAD */
+			if ((i & (INDIR_BIT | PAGE_BIT | 00170)) == (INDIR_BIT | 00010))
+				return 0;	/* Auto-index */
 			break;
-		case 4:	/* JMS - Jump to subroutine */
-			eadd();
-			IF = IB;
-			MA = IF | (MA & WORD_MASK);
-			MP[MA] = PC & WORD_MASK;	/* Save return address (12 bits) */
-			PC = MA + 1;				/* Code begins at next word */
-			break;
-		case 5:	/* JMP - Jump */
-			eadd();
-			IF = IB;
-			PC = IF | (MA & WORD_MASK);
-			/* Detect hot loops of the form:
-			  LOOP:	XXX (do something)
-					SKIP if YYY
-					JMP  LOOP (ie .-2)
-
-				This is probably waiting for an external event, like a key
-				press, so we do a keyboard read with 0.5 s timeout. If a key
-				has been pressed it will trigger an interrupt. Otherwise we
-				will have avoided a hot loop doing nothing by yielding the
-				CPU to the OS.
-			*/
-			if (PC == (THISPC - 2) && ((MP[THISPC-1] & 07400) == 07400)) {
-				tty_out_set_flag(4,1);
-				tty_keyb_timed_wait1(3);	/* Read 1 char for 0.5 sec */
-			}
+		case 5:	/* JMP, within the loop only */
+			if (i & INDIR_BIT)
+				return 0;
+			t = (a & (i & PAGE_BIT ? 077600 : 070000)) | (i & 00177);
+			if (t < PC || t > THISPC)
+				return 0;	/* May run code that isn't checked */
 			break;
-		case 6:	/* IOT - Input/output transfer */
-			input_output();
+		case 6:	/* Flag tests only */
+			switch (i) {
+			case 06011:	/* RSF */
+			case 06021:	/* PSF */
+			case 06031:	/* KSF */
+			case 06041:	/* TSF */
+				break;
+			default:
+				return 0;
+			}
 			break;
-		case 7:	/* OPR - Operate */
-			operate();
+		case 7:
+			if (!(i & GROUP_BIT))			/* Group 1 */
+				break;
+			if (!(i & 1)) {					/* Group 2 */
+				if (HLT(i))
+					return 0;
+				break;
+			}
+			if (i & 00016)					/* EAE with operand */
+				return 0;
 			break;
+		default:	/* ISZ, DCA, JMS */
+			return 0;
 		}
-		if (BP_NUM) {	// Are we leaving a breakpoint?
-			MP[THISPC] = HALT; // Yes, restore the HALT
-			BP_NUM = 0;
-		}
-		if (trace)
-			con_trace(THISPC, IR);
-		if (STOP) {
-			con_stop();
-			RUN = 0;
-			STOP = 0;
-		}
-		if (count && !--count)
-			RUN = 0;
-		if (keyb_delay && !--keyb_delay) {
-			tty_keyb_get_flag(3);
-			tty_out_set_flag(4,1);
-			keyb_delay = KEYB_DELAY;
+	}
+	return 1;
+}
+
+/* Skip the iterations of an idle loop (len instructions each) */
+static void cpu_idle(unsigned long len)
+{
+	unsigned long long now = cpu_time() + 1;	/* After this JMP */
+	unsigned long long next = tty_keyb_ahead() ? ev_next() : ev_next_other(EV_TTY_IN);
+	unsigned long long ns;
+	struct timespec t0, t1;
+	int ms = -1;
+	int rc;
+
+	tty_flush();	/* Show what the program is waiting after */
+	if (next != EV_NEVER) {
+		if (next <= now + len)
+			return;
+		ns = (next - now) * INSTR_NS;
+		ms = ns / 1000000 < INT_MAX ? (int)(ns / 1000000) : INT_MAX;
+	}
+
+	/* Sleep until a key is pressed or the next event is due */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	rc = ms ? tty_keyb_wait(ms) : -1;
+	if (rc < 0)		/* Can't, the next event will do */
+		next = ev_next();
+	else {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+		if (now + ns / INSTR_NS < next)
+			next = now + ns / INSTR_NS;
+		if (rc)		/* Read the key right away */
+			ev_schedule(EV_TTY_IN, 1);
+	}
+	if (next == EV_NEVER || next < now + len)
+		return;
+
+	cpu_request();
+	cycles += (next - now) / len * len;
+}
+
+/* A backward JMP closed a short loop (PC..THISPC) */
+static void cpu_loop(void)
+{
+	unsigned long long now;
+
+	if (THISPC == M->idle_pc && AC == M->idle_ac && L == M->idle_l
+		&& MQ == M->idle_mq && DF == M->idle_df
+		&& M->ev_fired == M->idle_fired && THISPC != M->idle_bad
+		&& !BP_COUNT && !WATCH_COUNT && !M->rev && !trace && !profile && !stats && !STOP && !ION_delay && !(IREQ && IEN && !CIF_delay)) {
+		now = cpu_time();
+		if (now - M->idle_time <= (unsigned long)(THISPC - PC + 1)
+			&& cpu_idle_body()) {
+			cpu_idle(now - M->idle_time);
+			M->idle_time = cpu_time();
+			M->idle_fired = M->ev_fired;
+			return;
 		}
-		if (IREQ && IEN && !ION_delay && !CIF_delay) {
-			/* Service interrupt */
-			/* JMS 0 in field 0 */
-			MP[0] = (PC & WORD_MASK);
-			PC = 1;
-			IEN = 0;
-			SF = (IF >> 9) | (DF >> 12);
-			IF = DF = 0;
+		M->idle_bad = THISPC;
+	}
+
+	M->idle_pc = THISPC;
+	M->idle_time = cpu_time();
+	M->idle_fired = M->ev_fired;
+	M->idle_ac = AC;
+	M->idle_l = L;
+	M->idle_mq = MQ;
+	M->idle_df = DF;
+}
+
+/* JMP - Jump (MA = target) */
+void cpu_jmp(void)
+{
+	IF = IB;
+	PC = IF | (MA & WORD_MASK);
+	if (PC <= THISPC && THISPC - PC < IDLE_SPAN)
+		cpu_loop();
+}
+
+static void op_jmp(DECODED *d)
+{
+	MA = IF | d->ea;
+	cpu_jmp();
+}
+
+static void op_jmp_ind(DECODED *d)
+{
+	indirect(d);
+	cpu_jmp();
+}
+
+/* IOT - Input/output transfer */
+static void op_iot(UNUSED DECODED *d)
+{
+	cpu_iot();
+}
+
+/* OPR - Operate (EAE, groups 1 and 2 have their own handlers) */
+static void op_opr(DECODED *d)
+{
+	IR = d->inst;	/* Not set in the middle of a block */
+	cpu_operate();
+}
+
+/* Fill the effective address and flags of the instruction inst at addr */
+static void decode_ea(DECODED *d, WORD addr, WORD inst)
+{
+	if (inst & PAGE_BIT)	/* Use current page */
+		d->ea = (addr & PAGE_MASK) | (inst & OFF_MASK);
+	else					/* Use page 0 */
+		d->ea = inst & OFF_MASK;
+
+	d->inst = inst;
+	d->flags = 0;
+	if (inst < 06000 && (inst & INDIR_BIT)) {
+		d->flags |= D_INDIRECT;
+		if ((d->ea & 07770) == 00010)	/* Addresses 0010 to 0017 */
+			d->flags |= D_AUTOINC;
+	}
+}
+
+/*
+   Superinstructions
+
+   A few common pairs of instructions are fused into a single handler
+   stored in the entry of the first one:
+
+	CLA [CLL] / TAD x		load
+	TAD x / DCA y			move (direct)
+	TAD I 1x / DCA I 1x		auto-index copy
+	ISZ x / JMP y			counted loop (direct)
+	KSF / JMP .-1			keyboard wait
+
+   The second half is executed in the same dispatch only if the first
+   one fell through to it, did not store into either word of the pair
+   and left nothing for cpu_attention() to do between them (no trace,
+   breakpoint, CTRL-C, end of count, keyboard poll or interrupt).
+   Otherwise the main loop picks up from there as usual. The second
+   word is tagged T_FUSED, so a store into it invalidates the fused
+   entry as well (see cpu_store_tagged) and self-modifying code always
+   sees the current instructions.
+*/
+
+/*
+   Between the two halves: return 1 if the second one can run now.
+   When it returns 0 the main loop calls cpu_attention() as usual.
+*/
+static int fuse_next(DECODED *d)
+{
+	WORD next = THISPC + 1;	/* Pairs never straddle a field */
+
+	if (PC != next || d->exec == cpu_decode || !CPU_QUIET(1))
+		return 0;
+
+	HIST_ADD(THISPC, IR);
+	CPU_COUNT(1);
+	MA = PC;
+	IR = MB = MP[MA];
+	THISPC = PC;
+	PC_INC();
+	return 1;
+}
+
+static void op_cla_tad(DECODED *d)
+{
+	AC = 0;
+	if (fuse_next(d)) {
+		if (d[1].flags & D_INDIRECT) op_tad_ind(d + 1);
+		else op_tad(d + 1);
+	}
+}
+
+static void op_cla_cll_tad(DECODED *d)
+{
+	AC = 0;
+	L = 0;
+	if (fuse_next(d)) {
+		if (d[1].flags & D_INDIRECT) op_tad_ind(d + 1);
+		else op_tad(d + 1);
+	}
+}
+
+static void op_tad_dca(DECODED *d)
+{
+	op_tad(d);
+	if (fuse_next(d))
+		op_dca(d + 1);
+}
+
+static void op_tad_dca_auto(DECODED *d)
+{
+	op_tad_ind(d);
+	if (fuse_next(d))
+		op_dca_ind(d + 1);
+}
+
+static void op_isz_jmp(DECODED *d)
+{
+	op_isz(d);
+	if (fuse_next(d))
+		op_jmp(d + 1);
+}
+
+static void op_ksf_jmp(DECODED *d)
+{
+	op_iot(d);
+	if (fuse_next(d))
+		op_jmp(d + 1);
+}
+
+/* Return the fused handler for the pair at d, or 0 */
+static void (*fuse(DECODED *d))(DECODED *)
+{
+	WORD addr = d - DC;
+	WORD next;
+
+	if ((addr & WORD_MASK) == WORD_MASK)	/* Last word of the field */
+		return 0;
+
+	next = MP[addr + 1];
+	if (d[1].exec == cpu_decode)
+		decode_ea(d + 1, addr + 1, next);
+
+	switch (IR >> 9) {
+	case 1:	/* TAD */
+		if (!(d->flags & D_INDIRECT) && (next >> 9) == 3 && !(d[1].flags & D_INDIRECT))
+			return op_tad_dca;
+		if ((d->flags & D_AUTOINC) && (next >> 9) == 3 && (d[1].flags & D_AUTOINC))
+			return op_tad_dca_auto;
+		break;
+	case 2:	/* ISZ */
+		if (!(d->flags & D_INDIRECT) && (next >> 9) == 5 && !(d[1].flags & D_INDIRECT))
+			return op_isz_jmp;
+		break;
+	case 6:	/* IOT */
+		if (IR == 06031 && (next >> 9) == 5 && !(d[1].flags & D_INDIRECT)
+			&& d[1].ea == (addr & WORD_MASK))
+			return op_ksf_jmp;
+		break;
+	case 7:	/* OPR */
+		if ((next >> 9) == 1) {
+			if (IR == 07200) return op_cla_tad;
+			if (IR == 07300) return op_cla_cll_tad;
 		}
+		break;
 	}
+
+	return 0;
 }
 
-/* Raise/lower interrupt request (for a device) */
-void cpu_ireq(int dev, int updown)
+/* Decode the instruction inst stored at addr into d (never fused) */
+void cpu_decode_op(DECODED *d, WORD addr, WORD inst)
 {
-	assert(dev <= 077);
+	static void (*const handlers[8][2])(DECODED *) = {
+		{ op_and, op_and_ind },
+		{ op_tad, op_tad_ind },
+		{ op_isz, op_isz_ind },
+		{ op_dca, op_dca_ind },
+		{ op_jms, op_jms_ind },
+		{ op_jmp, op_jmp_ind },
+		{ op_iot, op_iot },
+		{ op_opr, op_opr }
+	};
 
-	if (updown)
-		IREQ |= (1 << dev);
-	else
-		IREQ &= ~(1 << dev);
+	decode_ea(d, addr, inst);
+
+	d->exec = handlers[inst >> 9][!!(d->flags & D_INDIRECT)];
+	if ((inst >> 9) == 7) {	/* OPR: use the specialised handlers */
+		if (!(inst & GROUP_BIT))
+			d->exec = opr1_table[inst & 0377];
+		else if (!(inst & 1))
+			d->exec = opr2_table[(inst & 0377) >> 1];
+	}
 }
 
-/* Calculate effective memory address */
-static void eadd(void)
-{
-	if (IR & PAGE_BIT)	/* Use current page of current field */
-		MA = IF | (THISPC & PAGE_MASK) | (IR & OFF_MASK);
-	else				/* Use page 0 of current field */
-		MA = IF | (IR & OFF_MASK);
-	
-	/* Indirect addressing? */
-	if (IR & INDIR_BIT) {
-		/* Auto-increment? */
-		if ((MA & 07770) == 00010)	/* Addresses 0010 to 0017 */
-			MP[MA] = (MP[MA] + 1) & WORD_MASK;
-		MA = DF | MP[MA];
+/* Decode the instruction in IR, then execute it */
+void cpu_decode(DECODED *d)
+{
+	WORD addr = d - DC;
+	void (*fused)(DECODED *);
+
+	cpu_decode_op(d, addr, IR);
+	if ((fused = fuse(d))) {
+		d->exec = fused;
+		MT[addr + 1] |= T_FUSED;
 	}
+	(*d->exec)(d);
 }
 
-/* Check if next instruction is a JMP .-1 */
-static int cpu_is_jmpm1(void)
+/* Slow path of MEM_STORE: a word with tags was stored into */
+void cpu_store_tagged(WORD addr)
 {
-	WORD inst;
+	if (MT[addr] & T_FUSED)		/* Unfuse the previous instruction */
+		DC[addr - 1].exec = cpu_decode;
+	if (MT[addr] & T_BLOCK)		/* Drop the blocks covering it */
+		blk_invalidate(addr);
+	if (MT[addr] & T_WATCHW)
+		watch_store(addr);
+	if (MT[addr] & T_REV)		/* First store into its page since the snapshot */
+		rev_store(addr);
+	MT[addr] &= ~(T_FUSED | T_BLOCK);
+}
 
-	inst = 05000 | PAGE_BIT | ((PC-1) & PAGE_MASK);
+/* Raise/lower interrupt request (for a device) */
+void cpu_ireq(int dev, int updown)
+{
+	assert(dev <= 077);
 
-	return MP[PC] == inst;
+	if (updown) {
+		IREQ |= (1 << dev);
+		if (IEN) cpu_request();
+	} else
+		IREQ &= ~(1 << dev);
 }
 
-static void input_output(void)
+void cpu_iot(void)
 {
 	int dev = (IR >> 3) & 077;
 	int fun = IR & 07;
@@ -273,6 +792,7 @@ static void input_output(void)
 				break;
 			case 1: // ION  = 6001 turn interrupt ON
 				ION_delay = 1;	// Delay 1 instruction
+				cpu_request();
 				break;			
 			case 2: // IOF  = 6002 turn interrupt OFF
 				IEN = 0;
@@ -291,8 +811,10 @@ static void input_output(void)
 			case 5: // RTF  = 6005 restore flags
 				L = AC >> 11;
 				SF = AC & 077;
-				if (AC & 0200) ION_delay = 1;	// ION
-				else {							// IOF
+				if (AC & 0200) {				// ION
+					ION_delay = 1;
+					cpu_request();
+				} else {						// IOF
 					IEN = 0;
 					ION_delay = 0;
 				}
@@ -395,9 +917,7 @@ static void input_output(void)
 			break;
 		case 1: // KSF = 6031
 			// Skip is keyboard/flag = 1
-			// If next instruction is JMP .-1, wait until a key is pressed
-			if (cpu_is_jmpm1()) flag = tty_keyb_wait1(dev);
-			else flag = tty_keyb_get_flag(dev);
+			flag = tty_keyb_get_flag(dev);
 			if (flag)
 				PC_INC();
 			break;
@@ -418,7 +938,7 @@ static void input_output(void)
 		case 6: // KRB = 6036
 			// Clear AC, read keyboard buffer, clear keyboard flags
 			AC = tty_keyb_inp1(dev);
-			keyb_delay = KEYB_DELAY;
+			tty_keyb_schedule();	// Next poll
 			break;
 		case 7: // ??? = 6037
 			log_invalid();
@@ -433,7 +953,7 @@ static void input_output(void)
 			break;
 		case 1: // TSF = 6041
 			// Skip if teleprinter/punch flag is 1
-			//if (tty_out_get_flag(dev))
+			if (tty_out_get_flag(dev))
 				PC_INC();
 			break;
 		case 2: // TCF = 6042
@@ -453,6 +973,7 @@ static void input_output(void)
 		case 6: // TLS = 6046
 			// Clear teleprinter/punch flag
 			// Output AC as 7-bit ASCII
+			tty_out_set_flag(dev, 0);
 			tty_out1(dev, AC & 0x7F);
 			break;
 		case 7: // ??? = 6047
@@ -476,29 +997,15 @@ static void input_output(void)
 	}
 }
 
-static void operate(void)
+void cpu_operate(void)
 {
 	uint64_t temp;
 	int count;
 
 	if (!(IR & GROUP_BIT)) {	/* Group 1 */
-		if (CLA(IR)) AC = 0;
-		if (CLL(IR)) L = 0;
-		if (CMA(IR)) AC = ~AC & WORD_MASK;
-		if (CML(IR)) L = !L;
-		if (IAC(IR)) ALU_INC(AC);
-		if (RT(IR)) { /* Rotate twice */
-			if (RAL(IR)) { AC = (AC << 1) | L; L = GET_LINK; AC &= WORD_MASK; }
-			if (RAR(IR)) { AC = SET_LINK; L = AC & 1; AC >>= 1; }
-		}
-		if (RAL(IR)) { AC = (AC << 1) | L; L = GET_LINK; AC &= WORD_MASK; }
-		if (RAR(IR)) { AC = SET_LINK; L = AC & 1; AC >>= 1; }
-		if (BSW(IR) && !RAR(IR) && !RAL(IR)) { AC = ((AC & BYTE_MASK) << BYTE_BITS) | (AC >> BYTE_BITS); }
+		(*opr1_table[IR & 0377])(0);
 	} else if (!(IR & 1)) {		/* Group 2 */
-		skip_group();
-		if (CLA(IR)) AC = 0;
-		if (OSR(IR)) AC = AC | SR;
-		if (HLT(IR)) RUN = 0;
+		(*opr2_table[(IR & 0377) >> 1])(0);
 	} else {					/* Group 3 */
 		/* EAE instructions as in the PDP-8/I */
 		/* Sequence 1 */
@@ -591,25 +1098,7 @@ static void operate(void)
 	}
 }
 
-static void skip_group(void)
-{
-	int skip;
-
-	if (!RSS(IR)) {	/* Normal skip sense */
-		skip = 0;
-		if (SNL(IR) && L) skip = 1;
-		if (SZA(IR) && !AC) skip = 1;
-		if (SMA(IR) && (AC & SIGN_BIT)) skip = 1;
-	} else {		/* Reverse skip sense */
-		skip = 1;
-		if (SZL(IR) && L) skip = 0;
-		if (SNA(IR) && !AC) skip = 0;
-		if (SPA(IR) && (AC & SIGN_BIT)) skip = 0;
-	}
-
-	if (skip) PC_INC();
-}
-
+/* Initialize the current machine (all zeros) with kwords of memory */
 void cpu_init(size_t kwords)
 {
 	size_t i;
@@ -617,11 +1106,19 @@ void cpu_init(size_t kwords)
 	memwords = kwords * 1024;
 	nfields = kwords / 4;
 	MP = (WORD *)malloc(memwords * sizeof(WORD));
+	DC = (DECODED *)calloc(memwords, sizeof(DECODED));
+	MT = (unsigned char *)calloc(memwords, sizeof(unsigned char));
+	cpu_history(HIST_SIZE);
 	if (kwords > 4) HAVE_EMEM = 1;
+	cpu_engine = ENGINE_DECODED;
+
+	ev_init();
+	ev_handler(EV_COUNT, count_done);
+	rev_init();
 
 	/* Fill memory with halt instructions */
 	for (i = 0; i < memwords; ++i)
-		MP[i] = HALT;
+		MEM_STORE(i, HALT);
 
 	/* Initialize registers */
 	PC = 0;
@@ -636,6 +1133,10 @@ void cpu_init(size_t kwords)
 	IREQ = 0;
 	trace = 0;
 
+	/* Devices, which may request interrupts */
+	tty_reset();
+	ppt_init();
+
 //#define	DEBUG_XMEM
 #ifdef	DEBUG_XMEM
 /*
@@ -704,12 +1205,47 @@ RETURN,	CIF			/ USED TO CALCULATE EXIT INSTRUCTION
 #endif
 }
 
+/*
+   Keep the last n instructions executed in the history (rounded up to
+   a power of 2, HIST_MAX at most), which is cleared. Return 0 if done, -1 (history
+   unchanged) if out of memory.
+*/
+int cpu_history(unsigned long n)
+{
+	unsigned long size = 1;
+	HIST *h;
+
+	while (size < n && size < HIST_MAX)
+		size <<= 1;
+	if (!(h = calloc(size, sizeof(HIST))))
+		return -1;
+	free(M->hist);
+	M->hist = h;
+	M->hist_pos = 0;
+	M->hist_mask = size - 1;
+	++jit_gen;		/* The native code has the old ring built in */
+	return 0;
+}
+
 void cpu_stop(void)
 {
 	STOP = 1;
+	cpu_request();
 }
 
+/* Free everything the current machine has allocated */
 void cpu_deinit(void)
 {
-	log_close();
+	rev_start(0);
+	ppt_exit();
+	trace_close();
+	blk_free();
+	jit_free();
+	free(prof_count);
+	free(M->hist);
+	free(M->bp_table);
+	free(M->watch_table);
+	free(MP);
+	free(DC);
+	free(MT);
 }
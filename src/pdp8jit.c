@@ -0,0 +1,396 @@
+#ifndef	_DEFAULT_SOURCE
+#define	_DEFAULT_SOURCE		/* MAP_ANONYMOUS */
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pdp8.h"
+
+/*
+   x86-64 native code generator (selected with "-e jit")
+
+   The block engine (pdp8blk.c) counts how many times each block is
+   entered, and once a block reaches JIT_THRESHOLD it asks for the
+   straight-line part of it (all the instructions but the last one)
+   to be compiled here. Those are only AND, TAD, DCA, group 1 OPR,
+   CLA/OSR and the EAE register transfers, so the generated code
+   never changes the PC: it returns the number of instructions
+   executed and the engine executes the last one as usual.
+
+   Register usage inside the generated code:
+	esi		AC
+	edi		L
+	ecx		MQ
+	eax, edx, r11	scratch
+   AC, L and MQ are loaded on entry and stored back on exit and around
+   calls. The fields are compiled in as constants, so the code is only
+   valid while IF and DF are the ones it was compiled for; the engine
+   checks them on entry and drops the code when they differ.
+
+   Every store does what MEM_STORE does: the predecoded entry is
+   invalidated and tagged words go through cpu_store_tagged(). After
+   an instruction that stores, the code returns early if its own block
+   was invalidated, exactly where the interpreter would stop. Each
+   instruction is added to the history (see HIST_ADD) after it is
+   executed, with the ring and its mask built in as constants, so
+   cpu_history() increments jit_gen.
+
+   Each machine has its own buffer, since the code refers to its
+   registers and memory by address. When the buffer is full it is
+   reused from the start and jit_gen is incremented, which
+   invalidates all the code generated before.
+   On other hosts (or if the buffer can't be mapped) jit_compile()
+   returns 0 and the blocks are interpreted.
+*/
+
+#if defined(__x86_64__) && !defined(NO_JIT)
+
+#include <sys/mman.h>
+
+#ifndef	MAP_ANONYMOUS
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+
+#define	JIT_SIZE	(4 << 20)	/* Code buffer size */
+#define	JIT_MAXOP	768			/* Max code size of one instruction */
+
+#define	jit_buf	(M->jit_buf)	/* Code buffer (jit_gen is its generation) */
+#define	jit_pos	(M->jit_pos)	/* Next free byte in it */
+static THREAD_LOCAL unsigned char *cp;	/* Code pointer while compiling */
+
+/* Emit bytes */
+#define	EMIT(...)	emit((const unsigned char []){ __VA_ARGS__ }, \
+						sizeof((const unsigned char []){ __VA_ARGS__ }))
+
+static void emit(const unsigned char *p, size_t n)
+{
+	memcpy(cp, p, n);
+	cp += n;
+}
+
+static void emit32(uint32_t v)
+{
+	memcpy(cp, &v, 4);	/* Little-endian host */
+	cp += 4;
+}
+
+static void emit64(uint64_t v)
+{
+	memcpy(cp, &v, 8);
+	cp += 8;
+}
+
+/* mov rdx, p */
+static void emit_rdx(const void *p)
+{
+	EMIT(0x48, 0xBA);
+	emit64((uintptr_t)p);
+}
+
+/* Store AC, L and MQ into the globals */
+static void emit_flush(void)
+{
+	emit_rdx(&AC); EMIT(0x66, 0x89, 0x32);	/* mov [rdx], si */
+	emit_rdx(&L); EMIT(0x66, 0x89, 0x3A);	/* mov [rdx], di */
+	emit_rdx(&MQ); EMIT(0x66, 0x89, 0x0A);	/* mov [rdx], cx */
+}
+
+/* Load AC, L and MQ from the globals */
+static void emit_reload(void)
+{
+	emit_rdx(&AC); EMIT(0x0F, 0xB7, 0x32);	/* movzx esi, word [rdx] */
+	emit_rdx(&L); EMIT(0x0F, 0xB7, 0x3A);	/* movzx edi, word [rdx] */
+	emit_rdx(&MQ); EMIT(0x0F, 0xB7, 0x0A);	/* movzx ecx, word [rdx] */
+}
+
+/* Return n instructions executed (registers already flushed) */
+static void emit_return(int n)
+{
+	EMIT(0xB8); emit32(n);					/* mov eax, n */
+	EMIT(0x48, 0x83, 0xC4, 0x08);			/* add rsp, 8 */
+	EMIT(0xC3);								/* ret */
+}
+
+/* Rest of MEM_STORE, once MP[eax] has been stored into */
+static void emit_store_tail(void)
+{
+	void (*decode)(DECODED *) = cpu_decode;
+	void (*tagged)(WORD) = cpu_store_tagged;
+	unsigned char *jump;
+
+	/* DC[eax].exec = cpu_decode */
+	EMIT(0x49, 0xBB); emit64((uintptr_t)DC);	/* mov r11, DC */
+	EMIT(0x69, 0xD0); emit32(sizeof(DECODED));	/* imul edx, eax, size */
+	EMIT(0x4C, 0x01, 0xDA);						/* add rdx, r11 */
+	EMIT(0x49, 0xBB); emit64((uintptr_t)decode);/* mov r11, cpu_decode */
+	EMIT(0x4C, 0x89, 0x1A);						/* mov [rdx], r11 */
+
+	/* if (MT[eax]) cpu_store_tagged(eax) */
+	emit_rdx(MT);
+	EMIT(0x80, 0x3C, 0x02, 0x00);				/* cmp byte [rdx+rax], 0 */
+	EMIT(0x74, 0x00);							/* je over */
+	jump = cp;
+	emit_flush();
+	EMIT(0x89, 0xC7);							/* mov edi, eax */
+	EMIT(0x48, 0xB8); emit64((uintptr_t)tagged);/* mov rax, cpu_store_tagged */
+	EMIT(0xFF, 0xD0);							/* call rax */
+	emit_reload();
+	jump[-1] = cp - jump;
+}
+
+/* Return after instruction n if the block was invalidated */
+static void emit_check(WORD *len, int n)
+{
+	unsigned char *jump;
+
+	emit_rdx(len);
+	EMIT(0x66, 0x83, 0x3A, 0x00);	/* cmp word [rdx], 0 */
+	EMIT(0x75, 0x00);				/* jne over */
+	jump = cp;
+	emit_flush();
+	emit_return(n);
+	jump[-1] = cp - jump;
+}
+
+/* eax = MA = effective address of the memory reference instruction d */
+static void emit_ea(DECODED *d)
+{
+	WORD ptr = IF | d->ea;
+
+	if (!(d->flags & D_INDIRECT)) {
+		EMIT(0xB8); emit32(ptr);					/* mov eax, ptr */
+		emit_rdx(&MA);
+		EMIT(0x66, 0x89, 0x02);						/* mov [rdx], ax */
+		return;
+	}
+	if (d->flags & D_AUTOINC) {	/* MEM_STORE(ptr, MP[ptr] + 1) */
+		emit_rdx(&MP[ptr]);
+		EMIT(0x0F, 0xB7, 0x02);						/* movzx eax, word [rdx] */
+		EMIT(0xFF, 0xC0);							/* inc eax */
+		EMIT(0x25); emit32(WORD_MASK);				/* and eax, 07777 */
+		EMIT(0x66, 0x89, 0x02);						/* mov [rdx], ax */
+		EMIT(0xB8); emit32(ptr);					/* mov eax, ptr */
+		emit_store_tail();
+	}
+	emit_rdx(&MP[ptr]);
+	EMIT(0x0F, 0xB7, 0x02);							/* movzx eax, word [rdx] */
+	if (DF) {
+		EMIT(0x0D); emit32(DF);						/* or eax, DF */
+	}
+	emit_rdx(&MA);
+	EMIT(0x66, 0x89, 0x02);							/* mov [rdx], ax */
+}
+
+/* eax = MP[eax] */
+static void emit_load(void)
+{
+	emit_rdx(MP);
+	EMIT(0x0F, 0xB7, 0x04, 0x42);	/* movzx eax, word [rdx+rax*2] */
+}
+
+/* L ^= AC >> 12, AC &= 07777 (after an addition) */
+static void emit_carry(void)
+{
+	EMIT(0x89, 0xF0);						/* mov eax, esi */
+	EMIT(0xC1, 0xE8, WORD_BITS);			/* shr eax, 12 */
+	EMIT(0x31, 0xC7);						/* xor edi, eax */
+	EMIT(0x81, 0xE6); emit32(WORD_MASK);	/* and esi, 07777 */
+}
+
+static void emit_ral(void)
+{
+	EMIT(0xD1, 0xE6);						/* shl esi, 1 */
+	EMIT(0x09, 0xFE);						/* or esi, edi */
+	EMIT(0x89, 0xF7);						/* mov edi, esi */
+	EMIT(0xC1, 0xEF, WORD_BITS);			/* shr edi, 12 */
+	EMIT(0x81, 0xE6); emit32(WORD_MASK);	/* and esi, 07777 */
+}
+
+static void emit_rar(void)
+{
+	EMIT(0xC1, 0xE7, WORD_BITS);			/* shl edi, 12 */
+	EMIT(0x09, 0xFE);						/* or esi, edi */
+	EMIT(0x89, 0xF7);						/* mov edi, esi */
+	EMIT(0x83, 0xE7, 0x01);					/* and edi, 1 */
+	EMIT(0xD1, 0xEE);						/* shr esi, 1 */
+}
+
+/* Group 1 microinstructions, in the order of OPR1() in pdp8opr.c */
+static void emit_opr1(WORD i)
+{
+	if (CLA(i)) EMIT(0x31, 0xF6);						/* xor esi, esi */
+	if (CLL(i)) EMIT(0x31, 0xFF);						/* xor edi, edi */
+	if (CMA(i)) { EMIT(0x81, 0xF6); emit32(WORD_MASK); }/* xor esi, 07777 */
+	if (CML(i)) EMIT(0x83, 0xF7, 0x01);					/* xor edi, 1 */
+	if (IAC(i)) { EMIT(0xFF, 0xC6); emit_carry(); }		/* inc esi */
+	if (RT(i)) {
+		if (RAL(i)) emit_ral();
+		if (RAR(i)) emit_rar();
+	}
+	if (RAL(i)) emit_ral();
+	if (RAR(i)) emit_rar();
+	if (BSW(i) && !RAR(i) && !RAL(i)) {
+		EMIT(0x89, 0xF0);						/* mov eax, esi */
+		EMIT(0x83, 0xE0, BYTE_MASK);			/* and eax, 077 */
+		EMIT(0xC1, 0xE0, BYTE_BITS);			/* shl eax, 6 */
+		EMIT(0xC1, 0xEE, BYTE_BITS);			/* shr esi, 6 */
+		EMIT(0x09, 0xC6);						/* or esi, eax */
+	}
+}
+
+/* HIST_ADD(pc, ir) */
+static void emit_hist(WORD pc, WORD ir)
+{
+	emit_rdx(&M->hist_pos);
+	EMIT(0x8B, 0x02);							/* mov eax, [rdx] */
+	EMIT(0x44, 0x8D, 0x58, 0x01);				/* lea r11d, [rax+1] */
+	EMIT(0x44, 0x89, 0x1A);						/* mov [rdx], r11d */
+	EMIT(0x25); emit32(M->hist_mask);			/* and eax, mask */
+	EMIT(0x69, 0xC0); emit32(sizeof(HIST));		/* imul eax, eax, size */
+	emit_rdx(M->hist);
+	EMIT(0x48, 0x01, 0xC2);						/* add rdx, rax */
+	EMIT(0x66, 0xC7, 0x42, offsetof(HIST, pc));	/* mov word [rdx+pc], pc */
+	EMIT(pc & 0xFF, pc >> 8);
+	EMIT(0x66, 0xC7, 0x42, offsetof(HIST, ir));	/* mov word [rdx+ir], ir */
+	EMIT(ir & 0xFF, ir >> 8);
+	EMIT(0x66, 0x89, 0x72, offsetof(HIST, ac));	/* mov [rdx+ac], si */
+	EMIT(0x66, 0x89, 0x7A, offsetof(HIST, l));	/* mov [rdx+l], di */
+	EMIT(0x66, 0x89, 0x4A, offsetof(HIST, mq));	/* mov [rdx+mq], cx */
+	if (ir < 06000) {	/* Memory reference: MA */
+		EMIT(0x49, 0xBB); emit64((uintptr_t)&MA);	/* mov r11, &MA */
+		EMIT(0x41, 0x0F, 0xB7, 0x03);				/* movzx eax, word [r11] */
+		EMIT(0x66, 0x89, 0x42, offsetof(HIST, ma));	/* mov [rdx+ma], ax */
+	}
+}
+
+/* Compile instruction d at pc, the nth of the block */
+static void emit_op(DECODED *d, WORD pc, WORD *len, int n)
+{
+	WORD i = d->inst;
+
+	switch (i >> 9) {
+	case 0:	/* AND */
+		emit_ea(d);
+		emit_load();
+		EMIT(0x21, 0xC6);					/* and esi, eax */
+		break;
+	case 1:	/* TAD */
+		emit_ea(d);
+		emit_load();
+		EMIT(0x01, 0xC6);					/* add esi, eax */
+		emit_carry();
+		break;
+	case 3:	/* DCA */
+		emit_ea(d);
+		emit_rdx(MP);
+		EMIT(0x66, 0x89, 0x34, 0x42);		/* mov [rdx+rax*2], si */
+		EMIT(0x31, 0xF6);					/* xor esi, esi */
+		emit_store_tail();
+		break;
+	case 7:	/* OPR */
+		if (!(i & GROUP_BIT)) {
+			emit_opr1(i);
+		} else if (!(i & 1)) {	/* Group 2 without skips nor HLT */
+			if (CLA(i)) EMIT(0x31, 0xF6);	/* xor esi, esi */
+			if (OSR(i)) {
+				emit_rdx(&SR);
+				EMIT(0x0F, 0xB7, 0x02);		/* movzx eax, word [rdx] */
+				EMIT(0x09, 0xC6);			/* or esi, eax */
+			}
+		} else {				/* EAE register transfers */
+			if (CLA(i)) EMIT(0x31, 0xF6);	/* xor esi, esi */
+			switch ((i >> 4) & 07) {
+			case 1:	/* MQL */
+				EMIT(0x89, 0xF1);			/* mov ecx, esi */
+				break;
+			case 2:	/* SCA */
+				emit_rdx(&SC);
+				EMIT(0x0F, 0xB7, 0x02);		/* movzx eax, word [rdx] */
+				EMIT(0x09, 0xC6);			/* or esi, eax */
+				break;
+			case 4:	/* MQA */
+				EMIT(0x09, 0xCE);			/* or esi, ecx */
+				break;
+			case 5:	/* SWP */
+				EMIT(0x87, 0xCE);			/* xchg esi, ecx */
+				break;
+			}
+		}
+		break;
+	}
+	emit_hist(pc, i);
+
+	if ((i >> 9) == 3 || (i < 06000 && (d->flags & D_AUTOINC)))
+		emit_check(len, n);
+}
+
+/*
+   Compile the first n instructions of the block at addr for the
+   current IF and DF. len is the block length, which becomes 0 when
+   the block is invalidated. Return the code, or 0 if there's no JIT.
+*/
+JITCODE jit_compile(WORD addr, DECODED *op, int n, WORD *len)
+{
+	JITCODE code;
+	unsigned char *start;
+	int i;
+
+	if (!jit_buf) {
+		jit_buf = mmap(0, JIT_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (jit_buf == MAP_FAILED) {
+			jit_buf = 0;
+			cpu_engine = ENGINE_BLOCK;
+			return 0;
+		}
+	}
+	if (jit_pos + (n + 1) * JIT_MAXOP > JIT_SIZE) {	/* Full: start over */
+		jit_pos = 0;
+		++jit_gen;
+	}
+
+	start = cp = jit_buf + jit_pos;
+	EMIT(0x48, 0x83, 0xEC, 0x08);	/* sub rsp, 8 (align for calls) */
+	emit_reload();
+	for (i = 0; i < n; ++i)
+		emit_op(&op[i], addr + i, len, i + 1);
+	emit_flush();
+	emit_return(n);
+	jit_pos = cp - jit_buf;
+
+	memcpy(&code, &start, sizeof(code));
+	return code;
+}
+
+int jit_available(void)
+{
+	return 1;
+}
+
+void jit_free(void)
+{
+	if (jit_buf) {
+		munmap(jit_buf, JIT_SIZE);
+		jit_buf = 0;
+	}
+}
+
+#else	/* No JIT for this host */
+
+JITCODE jit_compile(UNUSED WORD addr, UNUSED DECODED *op, UNUSED int n, UNUSED WORD *len)
+{
+	return 0;
+}
+
+int jit_available(void)
+{
+	return 0;
+}
+
+void jit_free(void)
+{
+}
+
+#endif
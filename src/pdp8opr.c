@@ -0,0 +1,77 @@
+#include <stdio.h>
+
+#include "pdp8.h"
+
+/*
+   Specialised OPR handlers
+
+   There is one handler for each of the 256 group 1 microinstruction
+   combinations (7000-7377) and one for each of the 128 group 2
+   combinations (7400-7776, even). The group 2 words with bit 11 set
+   are EAE (group 3) instructions and are handled by cpu_operate().
+
+   The handlers are generated by the preprocessor: each one expands
+   OPR1() or OPR2() with its own instruction word as a constant, so
+   the compiler keeps only the microinstructions that are actually
+   present and the bit tests disappear. They are called directly by
+   the predecoded and threaded engines through opr1_table[] and
+   opr2_table[].
+*/
+
+/* Group 1, in the order of the event times */
+#define	OPR1(i) \
+	if (CLA(i)) AC = 0; \
+	if (CLL(i)) L = 0; \
+	if (CMA(i)) AC = ~AC & WORD_MASK; \
+	if (CML(i)) L = !L; \
+	if (IAC(i)) ALU_INC(AC); \
+	if (RT(i)) { /* Rotate twice */ \
+		if (RAL(i)) { AC = (AC << 1) | L; L = GET_LINK; AC &= WORD_MASK; } \
+		if (RAR(i)) { AC = SET_LINK; L = AC & 1; AC >>= 1; } \
+	} \
+	if (RAL(i)) { AC = (AC << 1) | L; L = GET_LINK; AC &= WORD_MASK; } \
+	if (RAR(i)) { AC = SET_LINK; L = AC & 1; AC >>= 1; } \
+	if (BSW(i) && !RAR(i) && !RAL(i)) { AC = ((AC & BYTE_MASK) << BYTE_BITS) | (AC >> BYTE_BITS); }
+
+/* Group 2: skips are tested before CLA */
+#define	OPR2(i) \
+	if (!RSS(i)) {	/* Normal skip sense */ \
+		if ((SNL(i) && L) || (SZA(i) && !AC) || (SMA(i) && (AC & SIGN_BIT))) \
+			PC_INC(); \
+	} else {		/* Reverse skip sense */ \
+		if (!((SZL(i) && L) || (SNA(i) && !AC) || (SPA(i) && (AC & SIGN_BIT)))) \
+			PC_INC(); \
+	} \
+	if (CLA(i)) AC = 0; \
+	if (OSR(i)) AC = AC | SR; \
+	if (HLT(i)) { RUN = 0; cpu_request(); }
+
+/* Handlers, named after the low 8 bits of the instruction in octal */
+#define	G1(a,b,c)	static void opr1_##a##b##c(UNUSED DECODED *d) { OPR1(0##a##b##c) }
+#define	G2(a,b,c)	static void opr2_##a##b##c(UNUSED DECODED *d) { OPR2(0##a##b##c) }
+
+#define	G1_8(a,b)	G1(a,b,0) G1(a,b,1) G1(a,b,2) G1(a,b,3) \
+					G1(a,b,4) G1(a,b,5) G1(a,b,6) G1(a,b,7)
+#define	G2_8(a,b)	G2(a,b,0) G2(a,b,2) G2(a,b,4) G2(a,b,6)
+
+#define	G_64(g,a)	g##_8(a,0) g##_8(a,1) g##_8(a,2) g##_8(a,3) \
+					g##_8(a,4) g##_8(a,5) g##_8(a,6) g##_8(a,7)
+
+G_64(G1,0) G_64(G1,1) G_64(G1,2) G_64(G1,3)
+G_64(G2,0) G_64(G2,1) G_64(G2,2) G_64(G2,3)
+
+/* Tables indexed by IR & 0377 (group 1) and (IR & 0377) >> 1 (group 2) */
+#define	T1(a,b,c)	opr1_##a##b##c,
+#define	T2(a,b,c)	opr2_##a##b##c,
+
+#define	T1_8(a,b)	T1(a,b,0) T1(a,b,1) T1(a,b,2) T1(a,b,3) \
+					T1(a,b,4) T1(a,b,5) T1(a,b,6) T1(a,b,7)
+#define	T2_8(a,b)	T2(a,b,0) T2(a,b,2) T2(a,b,4) T2(a,b,6)
+
+void (*const opr1_table[256])(DECODED *d) = {
+	G_64(T1,0) G_64(T1,1) G_64(T1,2) G_64(T1,3)
+};
+
+void (*const opr2_table[128])(DECODED *d) = {
+	G_64(T2,0) G_64(T2,1) G_64(T2,2) G_64(T2,3)
+};
@@ -0,0 +1,309 @@
+#include <stdio.h>
+
+#include "pdp8.h"
+#include "tty.h"
+
+/*
+   Threaded-code execution engine (selected with "-e threaded")
+
+   Each of the 4096 possible instruction words is mapped by thr_op[]
+   to a handler, so an instruction is dispatched with a single
+   indexed jump instead of going through the opcode switch and the
+   nested device/microinstruction switches of cpu_iot() and
+   cpu_operate(). The handler already knows the addressing mode of a
+   memory reference instruction, the IOT device/function or the OPR
+   microinstructions.
+
+   With GCC/Clang the handlers are labels and every handler ends with
+   its own computed goto to the next one (direct threading), which
+   gives the branch predictor one indirect jump per handler instead
+   of a single shared one. Other compilers get a switch on the
+   handler number.
+
+   Instructions without a handler of their own (most IOT's and EAE)
+   are executed by cpu_iot() and cpu_operate(), and the less common
+   OPR combinations by the specialised handlers of pdp8opr.c, exactly
+   like the default engine does.
+*/
+
+/*
+   Handlers. The memory reference instructions come first, 5 per
+   opcode and in opcode order, because thr_classify() computes them.
+	_Z	direct, page 0
+	_C	direct, current page
+	_IZ	indirect through page 0
+	_IC	indirect through current page
+	_IA	indirect through an auto-index register (0010-0017)
+*/
+#define	HANDLERS \
+	H(AND_Z) H(AND_C) H(AND_IZ) H(AND_IC) H(AND_IA) \
+	H(TAD_Z) H(TAD_C) H(TAD_IZ) H(TAD_IC) H(TAD_IA) \
+	H(ISZ_Z) H(ISZ_C) H(ISZ_IZ) H(ISZ_IC) H(ISZ_IA) \
+	H(DCA_Z) H(DCA_C) H(DCA_IZ) H(DCA_IC) H(DCA_IA) \
+	H(JMS_Z) H(JMS_C) H(JMS_IZ) H(JMS_IC) H(JMS_IA) \
+	H(JMP_Z) H(JMP_C) H(JMP_IZ) H(JMP_IC) H(JMP_IA) \
+	H(ION) H(IOF) H(CDF) H(CIF) H(CDI) H(TSF) H(TLS) H(IOT) \
+	H(NOP) H(CLA) H(CLL) H(CLA_CLL) H(CMA) H(CML) H(STL) \
+	H(IAC) H(CIA) H(CLA_IAC) H(RAL) H(RAR) H(RTL) H(RTR) \
+	H(CLL_RAL) H(CLL_RAR) \
+	H(SKP) H(SNL) H(SZL) H(SZA) H(SNA) H(SMA) H(SPA) \
+	H(SNL_CLA) H(SZL_CLA) H(SZA_CLA) H(SNA_CLA) H(SMA_CLA) H(SPA_CLA) \
+	H(HLT) H(OPR1) H(OPR2) H(OPR)
+
+#define	H(n)	T_##n,
+enum { HANDLERS T_COUNT };
+#undef	H
+
+/* Built on the first run in each thread */
+static THREAD_LOCAL unsigned char thr_op[4096];	/* Instruction -> handler */
+static THREAD_LOCAL int thr_ready;				/* thr_op[] has been built */
+
+/* Find the handler for instruction i */
+static int thr_classify(WORD i)
+{
+	int mode;
+
+	if ((i >> 9) < 6) {		/* Memory reference */
+		if (!(i & INDIR_BIT))
+			mode = (i & PAGE_BIT) ? 1 : 0;
+		else if (i & PAGE_BIT)
+			mode = 3;
+		else
+			mode = ((i & 00170) == 00010) ? 4 : 2;
+		return T_AND_Z + (i >> 9) * 5 + mode;
+	}
+
+	switch (i) {
+	case 06001:	return T_ION;
+	case 06002:	return T_IOF;
+	case 06041:	return T_TSF;
+	case 06046:	return T_TLS;
+
+	case 07000:	return T_NOP;
+	case 07200:	return T_CLA;
+	case 07600:	return T_CLA;	/* Group 2 CLA */
+	case 07100:	return T_CLL;
+	case 07300:	return T_CLA_CLL;
+	case 07040:	return T_CMA;
+	case 07020:	return T_CML;
+	case 07120:	return T_STL;
+	case 07001:	return T_IAC;
+	case 07041:	return T_CIA;
+	case 07201:	return T_CLA_IAC;
+	case 07004:	return T_RAL;
+	case 07010:	return T_RAR;
+	case 07006:	return T_RTL;
+	case 07012:	return T_RTR;
+	case 07104:	return T_CLL_RAL;
+	case 07110:	return T_CLL_RAR;
+
+	case 07410:	return T_SKP;
+	case 07420:	return T_SNL;
+	case 07430:	return T_SZL;
+	case 07440:	return T_SZA;
+	case 07450:	return T_SNA;
+	case 07500:	return T_SMA;
+	case 07510:	return T_SPA;
+	case 07620:	return T_SNL_CLA;
+	case 07630:	return T_SZL_CLA;
+	case 07640:	return T_SZA_CLA;
+	case 07650:	return T_SNA_CLA;
+	case 07700:	return T_SMA_CLA;
+	case 07710:	return T_SPA_CLA;
+	case 07402:	return T_HLT;
+	}
+
+	if ((i >> 9) == 6) {	/* IOT */
+		switch (i & 07707) {
+		case 06201:	return T_CDF;
+		case 06202:	return T_CIF;
+		case 06203:	return T_CDI;
+		}
+		return T_IOT;
+	}
+
+	if (!(i & GROUP_BIT))
+		return T_OPR1;
+	if (!(i & 1))
+		return T_OPR2;
+	return T_OPR;		/* EAE */
+}
+
+/* Effective address of a memory reference instruction */
+#define	AUTOINC	MEM_STORE(MA, (MP[MA] + 1) & WORD_MASK)
+#define	EA_Z	MA = IF | (IR & OFF_MASK)
+#define	EA_C	MA = IF | (THISPC & PAGE_MASK) | (IR & OFF_MASK)
+#define	EA_IZ	EA_Z; MA = DF | MP[MA]
+#define	EA_IC	EA_C; if ((MA & 07770) == 00010) AUTOINC; MA = DF | MP[MA]
+#define	EA_IA	EA_Z; AUTOINC; MA = DF | MP[MA]
+
+#define	FETCH() { \
+	MA = PC; \
+	IR = MB = MP[MA]; \
+	THISPC = PC; \
+	PC_INC(); \
+}
+
+#define	NEXT { \
+	HIST_ADD(THISPC, IR); \
+	if (--cpu_countdown <= 0) { \
+		cpu_attention(); \
+		if (!RUN) return; \
+	} \
+	FETCH(); \
+	DISPATCH(); \
+}
+
+#ifdef	__GNUC__
+#define	HANDLER(n)	L_##n
+#define	DISPATCH()	goto *thr_table[IR]
+#else
+#define	HANDLER(n)	case T_##n
+#define	DISPATCH()	goto dispatch
+#endif
+
+/* One handler for each addressing mode of a memory reference opcode */
+#define	MEMREF(op,body) \
+	HANDLER(op##_Z):	EA_Z;	body;	NEXT; \
+	HANDLER(op##_C):	EA_C;	body;	NEXT; \
+	HANDLER(op##_IZ):	EA_IZ;	body;	NEXT; \
+	HANDLER(op##_IC):	EA_IC;	body;	NEXT; \
+	HANDLER(op##_IA):	EA_IA;	body;	NEXT;
+
+#define	SKIP_IF(c)	if (c) PC_INC()
+#define	ROT_L		{ AC = (AC << 1) | L; L = GET_LINK; AC &= WORD_MASK; }
+#define	ROT_R		{ AC = SET_LINK; L = AC & 1; AC >>= 1; }
+
+#ifdef	__GNUC__
+/* Labels as values and computed goto are GNU extensions */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+void cpu_run_threaded(void)
+{
+	int i;
+
+	if (!thr_ready) {	/* First call: build the dispatch table */
+		for (i = 0; i < 4096; ++i)
+			thr_op[i] = thr_classify(i);
+		thr_ready = 1;
+	}
+
+#ifdef	__GNUC__
+#define	H(n)	&&L_##n,
+	static void *const labels[T_COUNT] = { HANDLERS };
+#undef	H
+	static THREAD_LOCAL void *thr_table[4096];
+
+	if (!thr_table[0]) {
+		for (i = 0; i < 4096; ++i)
+			thr_table[i] = labels[thr_op[i]];
+	}
+
+	FETCH();
+	DISPATCH();
+#else
+	FETCH();
+dispatch:
+	switch (thr_op[IR]) {
+#endif
+
+	/* Memory reference instructions */
+	MEMREF(AND, MB = MP[MA]; AC &= MB)
+	MEMREF(TAD, MB = MP[MA]; ALU_ADD(AC,MB))
+	MEMREF(ISZ, AUTOINC; SKIP_IF(!MP[MA]))
+	MEMREF(DCA, MEM_STORE(MA, AC); AC = 0)
+	MEMREF(JMS, cpu_jms())
+	MEMREF(JMP, cpu_jmp())
+
+	/* IOT */
+	HANDLER(ION):	/* 6001 */
+		ION_delay = 1;	// Delay 1 instruction
+		cpu_request();
+		NEXT;
+	HANDLER(IOF):	/* 6002 */
+		IEN = 0;
+		ION_delay = 0;
+		NEXT;
+	HANDLER(CDF):	/* 62N1 */
+		if (HAVE_EMEM && ((IR >> 3) & 7) < nfields)
+			DF = (IR & 00070) << 9;
+		NEXT;
+	HANDLER(CIF):	/* 62N2 */
+		if (HAVE_EMEM && ((IR >> 3) & 7) < nfields) {
+			IB = (IR & 00070) << 9;
+			CIF_delay = 1;
+		}
+		NEXT;
+	HANDLER(CDI):	/* 62N3 */
+		if (HAVE_EMEM && ((IR >> 3) & 7) < nfields) {
+			DF = IB = (IR & 00070) << 9;
+			CIF_delay = 1;
+		}
+		NEXT;
+	HANDLER(TSF):	/* 6041 */
+		if (tty_out_get_flag(4))
+			PC_INC();
+		NEXT;
+	HANDLER(TLS):	/* 6046 */
+		tty_out_set_flag(4, 0);
+		tty_out1(4, AC & 0x7F);
+		NEXT;
+	HANDLER(IOT):
+		cpu_iot();
+		NEXT;
+
+	/* OPR group 1 */
+	HANDLER(NOP):		NEXT;
+	HANDLER(CLA):		AC = 0; NEXT;
+	HANDLER(CLL):		L = 0; NEXT;
+	HANDLER(CLA_CLL):	AC = 0; L = 0; NEXT;
+	HANDLER(CMA):		AC = ~AC & WORD_MASK; NEXT;
+	HANDLER(CML):		L = !L; NEXT;
+	HANDLER(STL):		L = 1; NEXT;
+	HANDLER(IAC):		ALU_INC(AC); NEXT;
+	HANDLER(CIA):		AC = ~AC & WORD_MASK; ALU_INC(AC); NEXT;
+	HANDLER(CLA_IAC):	AC = 1; NEXT;
+	HANDLER(RAL):		ROT_L; NEXT;
+	HANDLER(RAR):		ROT_R; NEXT;
+	HANDLER(RTL):		ROT_L; ROT_L; NEXT;
+	HANDLER(RTR):		ROT_R; ROT_R; NEXT;
+	HANDLER(CLL_RAL):	L = 0; ROT_L; NEXT;
+	HANDLER(CLL_RAR):	L = 0; ROT_R; NEXT;
+
+	/* OPR group 2 */
+	HANDLER(SKP):		PC_INC(); NEXT;
+	HANDLER(SNL):		SKIP_IF(L); NEXT;
+	HANDLER(SZL):		SKIP_IF(!L); NEXT;
+	HANDLER(SZA):		SKIP_IF(!AC); NEXT;
+	HANDLER(SNA):		SKIP_IF(AC); NEXT;
+	HANDLER(SMA):		SKIP_IF(AC & SIGN_BIT); NEXT;
+	HANDLER(SPA):		SKIP_IF(!(AC & SIGN_BIT)); NEXT;
+	HANDLER(SNL_CLA):	SKIP_IF(L); AC = 0; NEXT;
+	HANDLER(SZL_CLA):	SKIP_IF(!L); AC = 0; NEXT;
+	HANDLER(SZA_CLA):	SKIP_IF(!AC); AC = 0; NEXT;
+	HANDLER(SNA_CLA):	SKIP_IF(AC); AC = 0; NEXT;
+	HANDLER(SMA_CLA):	SKIP_IF(AC & SIGN_BIT); AC = 0; NEXT;
+	HANDLER(SPA_CLA):	SKIP_IF(!(AC & SIGN_BIT)); AC = 0; NEXT;
+	HANDLER(HLT):		RUN = 0; cpu_request(); NEXT;
+
+	/* Other OPR's */
+	HANDLER(OPR1):
+		(*opr1_table[IR & 0377])(0);
+		NEXT;
+	HANDLER(OPR2):
+		(*opr2_table[(IR & 0377) >> 1])(0);
+		NEXT;
+	HANDLER(OPR):		/* EAE */
+		cpu_operate();
+		NEXT;
+
+#ifndef	__GNUC__
+	}
+#endif
+}
+
+#ifdef	__GNUC__
+#pragma GCC diagnostic pop
+#endif
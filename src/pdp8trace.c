@@ -0,0 +1,142 @@
+#ifndef	_POSIX_C_SOURCE
+#define	_POSIX_C_SOURCE	200112L		/* getopt */
+#endif
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pdp8.h"
+#include "trace.h"
+
+/*
+   Binary trace decoder: pdp8trace [<options>] <trace file>
+
+	-a <addr>[-<addr>]	Only the instructions at these addresses
+	-i <inst>[/<mask>]	Only the instructions with (IR & mask) == inst
+	-n <count>			Only the last count instructions (decimal)
+
+   Prints the records of a trace written by the trace bin command (or
+   pdp8_trace()), from the oldest still in the ring to the latest, in
+   the format of a text trace plus the time (instructions since power
+   up) each one ended. Addresses, instructions and masks are octal.
+*/
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a <addr>[-<addr>]] [-i <inst>[/<mask>]] [-n <count>] <trace file>\n",
+		name);
+	exit(1);
+}
+
+/* Parse "<n>[<sep><m>]" in base into *n and *m (*m unchanged if absent). Return 0 if valid */
+static int parse_pair(const char *s, int sep, int base, unsigned long *n, unsigned long *m)
+{
+	char *end;
+
+	*n = strtoul(s, &end, base);
+	if (end == s)
+		return -1;
+	if (sep && *end == sep) {
+		s = end + 1;
+		*m = strtoul(s, &end, base);
+		if (end == s)
+			return -1;
+	}
+	return *end ? -1 : 0;
+}
+
+static void print_rec(const TRACEREC *r)
+{
+	DINSTR inst;
+
+	inst.addr = r->pc;
+	inst.inst = r->ir;
+	cpu_disasm(&inst);
+
+	printf("PC=%05o [%04o] ", r->pc, r->ir);
+	if (inst.args[0])
+		printf("%-8s %-8s", inst.name, inst.args);
+	else
+		printf("%-16s ", inst.name);
+	printf("L=%d  AC=%04o  MQ=%04o  IF=%d  DF=%d  MA=%05o IEN=%d  IREQ=%d  T=%lu\n",
+		r->flags & TR_LINK, r->ac, r->mq, r->fields >> 3, r->fields & 7, r->ma,
+		!!(r->flags & TR_IEN), !!(r->flags & TR_IREQ), (unsigned long)r->time);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long lo = 0, hi = 077777, ir = 0, mask = 0, last = 0;
+	unsigned long long n, first, i;
+	const TRACEHDR *hdr;
+	const TRACEREC *rec, *r;
+	unsigned char *p;
+	struct stat sb;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "a:i:n:")) != -1) {
+		switch (opt) {
+		case 'a':
+			hi = ~0UL;
+			if (parse_pair(optarg, '-', 8, &lo, &hi))
+				usage(argv[0]);
+			if (hi == ~0UL)
+				hi = lo;
+			break;
+		case 'i':
+			mask = 07777;
+			if (parse_pair(optarg, '/', 8, &ir, &mask))
+				usage(argv[0]);
+			ir &= mask;
+			break;
+		case 'n':
+			if (parse_pair(optarg, 0, 10, &last, &last) || !last)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if ((fd = open(argv[optind], O_RDONLY)) < 0) {
+		fprintf(stderr, "Could not open '%s'\n", argv[optind]);
+		return 1;
+	}
+	if (fstat(fd, &sb) || (size_t)sb.st_size < TRACE_DATA
+		|| (p = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "'%s' is not a trace\n", argv[optind]);
+		return 1;
+	}
+	close(fd);
+
+	hdr = (const TRACEHDR *)p;
+	rec = (const TRACEREC *)(p + TRACE_DATA);
+	n = hdr->count < hdr->records ? hdr->count : hdr->records;
+	if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic))
+		|| hdr->version != TRACE_VERSION
+		|| hdr->rec_size != sizeof(TRACEREC)
+		|| !hdr->records || (hdr->records & (hdr->records - 1))
+		|| TRACE_DATA + n * sizeof(TRACEREC) > (size_t)sb.st_size) {
+		fprintf(stderr, "'%s' is not a trace from this build\n", argv[optind]);
+		return 1;
+	}
+
+	/* Oldest record kept */
+	first = hdr->count - n;
+	if (last && last < n)
+		first = hdr->count - last;
+	for (i = first; i < hdr->count; ++i) {
+		r = &rec[i & (hdr->records - 1)];
+		if (r->pc < lo || r->pc > hi || (r->ir & mask) != ir)
+			continue;
+		print_rec(r);
+	}
+
+	munmap(p, sb.st_size);
+	return 0;
+}
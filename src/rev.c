@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event.h"
+#include "pdp8.h"
+
+/*
+   Reverse execution
+
+   While it is on (rev_start), the machine can be taken back to any
+   time since its oldest snapshot: the latest snapshot taken by then
+   is restored, and the machine runs forward from there up to that
+   time again (rev_back). It ends in the state it was in, because all
+   the rest is deterministic once these are recorded:
+
+	Snapshots: the STATE and the memory pages stored into since the
+	previous snapshot, taken every interval instructions (EV_REV)
+	and at the start of each run, so that a replay never goes
+	through the start of a run, nor what was changed from the
+	console between two. Each word is tagged T_REV until its page
+	is first stored into after a snapshot. The memory of the oldest
+	snapshot is kept whole (base); that of any other is the base
+	with the pages of the next ones up to it.
+
+	Inputs: each character the keyboard or the reader gave the
+	machine is logged with the time it did. Once back, they are
+	given to it again at the same times instead of what the host
+	has, until the log runs out or the machine doesn't take the
+	next one at its time (it was changed meanwhile): the rest of
+	the log is then dropped.
+
+	Interrupts are requested by the devices from events, which are
+	part of the STATE and due at times counted in instructions, so
+	they come between the same instructions again. Idle loops are
+	not skipped while reverse execution is on, as that follows the
+	host's clock.
+
+   Nothing is printed or punched again before the latest time reached.
+   Snapshots are only taken when running forward for the first time
+   since the last one, never while replaying.
+
+   Snapshot i (from 0, the oldest) is snap[(first + i) % REV_SNAPS].
+*/
+#define	rev		(M->rev)
+
+#define	REV_SNAPS		4096	/* Snapshots kept, the oldest are dropped */
+#define	REV_PAGE		(1 << PAGE_SHFT)	/* Words per page */
+#define	REV_LOG			1024	/* Initial size of the input log */
+#define	SNAP(i)			(&rev->snap[(rev->first + (i)) % REV_SNAPS])
+#define	REV_PAGES		((int)(memwords / REV_PAGE))	/* In the memory */
+
+typedef struct {
+	unsigned long long time;	/* When it was taken */
+	STATE st;
+	size_t log_pos;			/* Inputs logged before */
+	int npages;				/* Pages stored into since the previous one */
+	unsigned char *page;	/* Their numbers */
+	WORD *data;				/* and contents, REV_PAGE words each */
+} REVSNAP;
+
+typedef struct {
+	unsigned long long time;	/* When the machine got it */
+	int kind;				/* REV_KEYB, REV_READER */
+	int value;
+} REVREC;
+
+struct reverse {
+	unsigned long interval;	/* Instructions between snapshots */
+	REVSNAP snap[REV_SNAPS];
+	int first;				/* Oldest */
+	int count;
+	WORD *base;				/* Memory of the oldest snapshot */
+	unsigned char *dirty;	/* 1 for each page stored into since the last one */
+	REVREC *log;			/* Inputs, in the order they were given */
+	size_t len;				/* Logged */
+	size_t pos;				/* Next one to give again (len=none) */
+	size_t size;			/* Room in log */
+	unsigned long long high;	/* Latest time reached */
+	int replay;				/* Running forward again to a time? */
+};
+
+/* EV_REV: a snapshot is due after the current instruction */
+static void rev_event(void)
+{
+	if (rev)
+		M->rev_due = 1;
+}
+
+void rev_init(void)
+{
+	ev_handler(EV_REV, rev_event);
+}
+
+/* Tag the words of page p as not stored into since the last snapshot */
+static void rev_clean(int p)
+{
+	WORD a;
+
+	for (a = p * REV_PAGE; a < (p + 1) * REV_PAGE; ++a)
+		MT[a] |= T_REV;
+	rev->dirty[p] = 0;
+}
+
+/* Drop the oldest snapshot: the next one is folded into the base */
+static void rev_drop(void)
+{
+	REVSNAP *s = SNAP(0);
+	size_t n;
+	int i;
+
+	free(s->page);
+	free(s->data);
+	rev->first = (rev->first + 1) % REV_SNAPS;
+	--rev->count;
+
+	s = SNAP(0);
+	for (i = 0; i < s->npages; ++i)
+		memcpy(rev->base + s->page[i] * REV_PAGE, s->data + i * REV_PAGE,
+			REV_PAGE * sizeof(WORD));
+	free(s->page);
+	free(s->data);
+	s->page = 0;
+	s->data = 0;
+	s->npages = 0;
+
+	/* The inputs before it can't be given again */
+	if ((n = s->log_pos)) {
+		memmove(rev->log, rev->log + n, (rev->len - n) * sizeof(REVREC));
+		rev->len -= n;
+		rev->pos -= n;
+		for (i = 0; i < rev->count; ++i)
+			SNAP(i)->log_pos -= n;
+	}
+}
+
+/* Drop the snapshots after snapshot i */
+static void rev_cut(int i)
+{
+	REVSNAP *s;
+
+	while (rev->count > i + 1) {
+		s = SNAP(--rev->count);
+		free(s->page);
+		free(s->data);
+	}
+}
+
+/* Take a snapshot, unless replaying. Called between two instructions */
+void rev_snap(void)
+{
+	unsigned long long now = cpu_time();
+	REVSNAP *s;
+	int p, n = 0;
+
+	M->rev_due = 0;
+	ev_schedule(EV_REV, rev->interval);
+	if (rev->replay)
+		return;
+
+	if (rev->count == REV_SNAPS)
+		rev_drop();
+	s = SNAP(rev->count);
+	memset(s, 0, sizeof(*s));
+	for (p = 0; p < REV_PAGES; ++p)
+		n += rev->dirty[p];
+	if (n && (!(s->page = malloc(n)) || !(s->data = malloc(n * REV_PAGE * sizeof(WORD))))) {
+		free(s->page);
+		rev_start(rev->interval);	/* Out of memory: forget the past */
+		return;
+	}
+	for (p = 0; p < REV_PAGES; ++p) {
+		if (!rev->dirty[p])
+			continue;
+		s->page[s->npages] = p;
+		memcpy(s->data + s->npages * REV_PAGE, MP + p * REV_PAGE, REV_PAGE * sizeof(WORD));
+		++s->npages;
+		rev_clean(p);
+	}
+	s->time = now;
+	s->st = M->st;
+	s->log_pos = rev->pos;
+	++rev->count;
+	if (now > rev->high)
+		rev->high = now;
+}
+
+/*
+   Start reverse execution from now, with a snapshot every interval
+   instructions, or stop it if interval is 0. Whatever was recorded
+   is dropped. Return 0 if done, -1 (off) if out of memory.
+*/
+int rev_start(unsigned long interval)
+{
+	struct reverse *r;
+	size_t a;
+
+	if (rev) {
+		rev_cut(0);
+		free(SNAP(0)->page);
+		free(SNAP(0)->data);
+		free(rev->base);
+		free(rev->dirty);
+		free(rev->log);
+		free(rev);
+		rev = 0;
+		ev_cancel(EV_REV);
+		M->rev_due = 0;
+		for (a = 0; a < memwords; ++a)
+			MT[a] &= ~T_REV;
+	}
+	if (!interval)
+		return 0;
+
+	if (!(r = calloc(1, sizeof(*r)))
+		|| !(r->base = malloc(memwords * sizeof(WORD)))
+		|| !(r->dirty = calloc(REV_PAGES, 1))) {
+		if (r)
+			free(r->base);
+		free(r);
+		return -1;
+	}
+	rev = r;
+	rev->interval = interval;
+	memcpy(rev->base, MP, memwords * sizeof(WORD));
+	for (a = 0; a < memwords; ++a)
+		MT[a] |= T_REV;
+	rev_snap();
+	return 0;
+}
+
+/* The memory was replaced as a whole (snapshot restored): start again from it */
+void rev_reset(void)
+{
+	if (rev)
+		rev_start(rev->interval);
+}
+
+/*
+   Return the number of snapshots (0=off), with the interval between
+   them and the time of the oldest.
+*/
+int rev_status(unsigned long *interval, unsigned long long *oldest)
+{
+	if (!rev)
+		return 0;
+	*interval = rev->interval;
+	*oldest = SNAP(0)->time;
+	return rev->count;
+}
+
+/* Called by cpu_store_tagged(): addr (tagged T_REV) was stored into */
+void rev_store(WORD addr)
+{
+	int p = addr >> PAGE_SHFT;
+	WORD a;
+
+	for (a = p * REV_PAGE; a < (p + 1) * REV_PAGE; ++a)
+		MT[a] &= ~T_REV;
+	rev->dirty[p] = 1;
+}
+
+/* Called at the end of each run */
+void rev_stopped(void)
+{
+	unsigned long long now = cpu_time();
+
+	if (now > rev->high)
+		rev->high = now;
+}
+
+/* Return 1 if output now was already printed or punched */
+int rev_quiet(void)
+{
+	return rev->replay || cpu_time() < rev->high;
+}
+
+/*
+   The machine takes an input of kind now. Return the one logged for
+   now, -1 if none is (a key comes later), or REV_LIVE if the log has
+   run out: the caller then takes it from the host and logs it with
+   rev_record().
+*/
+int rev_input(int kind)
+{
+	unsigned long long now = cpu_time();
+	REVREC *r;
+
+	if (rev->pos == rev->len)
+		return REV_LIVE;
+	r = &rev->log[rev->pos];
+	if (r->time == now && r->kind == kind) {
+		++rev->pos;
+		return r->value;
+	}
+	if (r->time > now && kind == REV_KEYB)
+		return -1;
+
+	/* Not what happened: what was logged after is of no use */
+	rev->len = rev->pos;
+	if (!rev->replay)
+		rev->high = now;
+	return REV_LIVE;
+}
+
+/* Log input value of kind, just taken from the host */
+void rev_record(int kind, int value)
+{
+	REVREC *r;
+	size_t size;
+
+	if (rev->len == rev->size) {
+		size = rev->size ? 2 * rev->size : REV_LOG;
+		if (!(r = realloc(rev->log, size * sizeof(REVREC)))) {
+			rev_start(rev->interval);	/* Can't be given again */
+			return;
+		}
+		rev->log = r;
+		rev->size = size;
+	}
+	r = &rev->log[rev->len++];
+	r->time = cpu_time();
+	r->kind = kind;
+	r->value = value;
+	rev->pos = rev->len;
+}
+
+/* Restore snapshot i */
+static void rev_restore(int i)
+{
+	unsigned long long now = cpu_time();
+	REVSNAP *s;
+	size_t a;
+	int n, j;
+
+	memcpy(MP, rev->base, memwords * sizeof(WORD));
+	for (n = 1; n <= i; ++n) {
+		s = SNAP(n);
+		for (j = 0; j < s->npages; ++j)
+			memcpy(MP + s->page[j] * REV_PAGE, s->data + j * REV_PAGE,
+				REV_PAGE * sizeof(WORD));
+	}
+	s = SNAP(i);
+	M->st = s->st;
+	M->st.countdown = M->st.countdown_len = 0;	/* Time is s->time */
+	M->rev_due = 0;
+	rev->pos = s->log_pos;
+	memset(rev->dirty, 0, REV_PAGES);
+
+	/* Nothing derived from the memory is valid */
+	blk_free();
+	for (a = 0; a < memwords; ++a) {
+		MT[a] = (MT[a] & T_KEEP) | T_REV;
+		DC[a].exec = cpu_decode;
+	}
+
+	/* The instructions after it are recorded again (one per time) */
+	if (now > s->time)
+		M->hist_pos -= now - s->time < M->hist_pos ? now - s->time : M->hist_pos;
+}
+
+/*
+   Run forward again up to time, with no trace, profile or statistics,
+   nor breakpoints and watchpoints unless debug is set, and no reports
+   from the watchpoints that only log.
+*/
+static void rev_replay(unsigned long long time, int debug)
+{
+	int tr = trace, pr = profile, st = stats, bp = BP_COUNT, wp = WATCH_COUNT;
+	void (*on_watch)(int n, WORD addr, int write) = M->on_watch;
+
+	trace = profile = stats = 0;
+	M->on_watch = 0;
+	if (!debug)
+		BP_COUNT = WATCH_COUNT = 0;
+	BP_NUM = WATCH_NUM = 0;
+	rev->replay = 1;
+	if (time > cpu_time())
+		cpu_replay(time - cpu_time());
+	RUN = 0;		/* Even if it didn't run, as taken at the start of a run */
+	rev->replay = 0;
+	trace = tr;
+	profile = pr;
+	stats = st;
+	BP_COUNT = bp;
+	WATCH_COUNT = wp;
+	M->on_watch = on_watch;
+	M->watch_stores = 0;
+}
+
+/*
+   Take the machine back to time, from the oldest snapshot to now.
+   Return 0 if done, -1 if it can't. If the replay is stopped (CTRL-C),
+   the machine is left on the way.
+*/
+int rev_back(unsigned long long time)
+{
+	int i;
+
+	if (!rev || time < SNAP(0)->time || time > cpu_time())
+		return -1;
+	rev_stopped();
+	for (i = rev->count - 1; i > 0 && SNAP(i)->time > time; --i)
+		;
+	rev_restore(i);
+	rev_cut(i);		/* The others are taken again going forward */
+	rev_replay(time, 0);
+	return 0;
+}
+
+/*
+   Take the machine back to the last time before now a breakpoint or
+   a watchpoint would have stopped it, whatever their skip counts, or
+   to the oldest snapshot if none would have. Return 0 if one did
+   (BP_NUM or WATCH_NUM tells which), 1 if none, -1 if it can't go
+   back or a replay was stopped (CTRL-C).
+
+   The intervals between snapshots are replayed the latest first, with
+   the breakpoints and watchpoints on, until one where they stop.
+*/
+int rev_continue(void)
+{
+	unsigned long long now = cpu_time(), end = now, stop = 0;
+	BREAK *bt = 0;
+	WATCH *wt = 0;
+	int bn = 0, wn = 0, wr = 0, rc = 1;
+	WORD addr = 0;
+	int i, n;
+
+	if (!rev || (!BP_COUNT && !WATCH_COUNT))
+		return rev_back(rev ? SNAP(0)->time : now) ? -1 : 1;
+	if ((M->bp_slots && !(bt = malloc(M->bp_slots * sizeof(BREAK))))
+		|| (M->watch_slots && !(wt = malloc(M->watch_slots * sizeof(WATCH))))) {
+		free(bt);
+		return -1;
+	}
+	if (bt)
+		memcpy(bt, M->bp_table, M->bp_slots * sizeof(BREAK));
+	if (wt)
+		memcpy(wt, M->watch_table, M->watch_slots * sizeof(WATCH));
+	for (n = 0; n < M->bp_slots; ++n)
+		M->bp_table[n].skip = 0;
+	rev_stopped();
+
+	for (i = rev->count - 1; i >= 0; end = SNAP(i--)->time) {
+		if (SNAP(i)->time >= end)
+			continue;
+		rev_restore(i);
+		if (BP_COUNT && (MT[PC] & T_BREAK) && (BP_NUM = brk_stop())) {
+			stop = cpu_time();
+			bn = BP_NUM;
+			wn = 0;
+			rc = 0;
+		}
+		for (;;) {
+			rev_replay(end, 1);
+			if (!BP_NUM && !WATCH_NUM) {
+				if (cpu_time() < end)
+					rc = -1;	/* Stopped */
+				break;
+			}
+			if (cpu_time() < now) {		/* Not where it is stopped now */
+				stop = cpu_time();
+				bn = BP_NUM;
+				wn = WATCH_NUM;
+				addr = M->watch_addr;
+				wr = M->watch_write;
+				rc = 0;
+			}
+			if (cpu_time() >= end)
+				break;
+		}
+		if (rc != 1)
+			break;
+	}
+
+	if (bt)
+		memcpy(M->bp_table, bt, M->bp_slots * sizeof(BREAK));
+	if (wt)
+		memcpy(M->watch_table, wt, M->watch_slots * sizeof(WATCH));
+	free(bt);
+	free(wt);
+	if (rc < 0) {
+		rev_cut(i);		/* Left on the way */
+		return rc;
+	}
+	if (rev_back(rc ? SNAP(0)->time : stop))
+		return -1;
+	BP_NUM = bn;
+	WATCH_NUM = wn;
+	M->watch_addr = addr;
+	M->watch_write = wr;
+	return rc;
+}
@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pdp8.h"
+#include "libpdp8.h"
+
+/*
+   Snapshots (save/restore)
+
+   A snapshot is the STATE of a machine (registers, flip-flops, device
+   flags, pending events...) followed by its memory, as they are kept
+   by the simulator:
+
+	SNAPHDR		magic, version and sizes
+	STATE		at SNAP_STATE
+	MP			at SNAP_PAGE, memwords WORD's
+
+   The memory starts on a page boundary so that the file can be mapped
+   and used as is. Restoring maps the file and copies the two parts
+   into the machine, then drops everything derived from the old memory
+   (decoded instructions, tags, blocks, native code).
+
+   The format is that of the host and of the build: the STATE is not
+   converted, only checked by its size, and SNAP_VERSION must change
+   whenever its layout does. The files assigned to devices, the
+   callbacks, the engine, breakpoints and trace are not part of the
+   machine state and are left as they are.
+*/
+
+#define	SNAP_MAGIC		"PDP8SNAP"
+#define	SNAP_VERSION	4
+#define	SNAP_PAGE		4096	/* Offset of MP */
+#define	SNAP_STATE		64		/* Offset of the STATE */
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t state_size;	/* sizeof(STATE) */
+	uint32_t state_offset;
+	uint32_t word_size;		/* sizeof(WORD) */
+	uint32_t mem_words;
+	uint32_t mem_offset;
+} SNAPHDR;
+
+/* Save the machine to fname. Return 0 if done */
+int pdp8_save(PDP8 *m, const char *fname)
+{
+	SNAPHDR hdr;
+	FILE *out;
+	int rc = 0;
+
+	M = m;
+	if (!(out = fopen(fname, "wb")))
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.state_size = sizeof(STATE);
+	hdr.state_offset = SNAP_STATE;
+	hdr.word_size = sizeof(WORD);
+	hdr.mem_words = memwords;
+	hdr.mem_offset = (SNAP_STATE + sizeof(STATE) + SNAP_PAGE - 1) & ~(SNAP_PAGE - 1);
+
+	/* The gaps are left as holes, read back as zeros */
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1
+		|| fseek(out, SNAP_STATE, SEEK_SET)
+		|| fwrite(&M->st, sizeof(STATE), 1, out) != 1
+		|| fseek(out, hdr.mem_offset, SEEK_SET)
+		|| fwrite(MP, sizeof(WORD), memwords, out) != memwords)
+		rc = -1;
+	if (fclose(out))
+		rc = -1;
+	return rc;
+}
+
+/*
+   Restore the machine from fname, which must have been saved with the
+   same memory size. Return 0 if done, -1 (machine unchanged) if not.
+*/
+int pdp8_restore(PDP8 *m, const char *fname)
+{
+	const SNAPHDR *hdr;
+	unsigned char *p;
+	struct stat sb;
+	size_t a;
+	int fd;
+	int rc = -1;
+
+	M = m;
+	if ((fd = open(fname, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &sb) || (size_t)sb.st_size < SNAP_PAGE
+		|| (p = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	hdr = (const SNAPHDR *)p;
+	if (!memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic))
+		&& hdr->version == SNAP_VERSION
+		&& hdr->state_size == sizeof(STATE)
+		&& hdr->word_size == sizeof(WORD)
+		&& hdr->mem_words == memwords
+		&& hdr->state_offset + sizeof(STATE) <= hdr->mem_offset
+		&& hdr->mem_offset + memwords * sizeof(WORD) <= (size_t)sb.st_size) {
+		memcpy(&M->st, p + hdr->state_offset, sizeof(STATE));
+		memcpy(MP, p + hdr->mem_offset, memwords * sizeof(WORD));
+		rc = 0;
+	}
+	munmap(p, sb.st_size);
+	if (rc)
+		return rc;
+
+	/* Nothing derived from the old memory is valid */
+	blk_free();
+	for (a = 0; a < memwords; ++a) {
+		MT[a] &= T_KEEP;
+		DC[a].exec = cpu_decode;
+	}
+	rev_reset();
+	return 0;
+}
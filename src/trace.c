@@ -0,0 +1,103 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pdp8.h"
+#include "libpdp8.h"
+#include "trace.h"
+
+/*
+   Binary trace
+
+   pdp8_trace() maps a trace file (see trace.h) of a fixed size into
+   memory and turns the trace on. cpu_attention() then calls
+   trace_write() after each instruction, which fills one record of
+   the ring: a handful of stores, no formatting and no system calls.
+   Once the ring is full the oldest records are overwritten, so the
+   file never grows past its size and always holds the end of the
+   run. The count in the header is kept up to date, so the file can
+   be read at any time, even after a crash. pdp8trace decodes it.
+*/
+
+/* Record the instruction just executed */
+void trace_write(void)
+{
+	TRACEHDR *h = M->trace_hdr;
+	TRACEREC *r = &M->trace_rec[h->count & (h->records - 1)];
+
+	r->time = cpu_time();
+	r->pc = THISPC;
+	r->ir = IR;
+	r->ac = AC;
+	r->mq = MQ;
+	r->ma = MA;
+	r->flags = L | (IEN ? TR_IEN : 0) | (IREQ ? TR_IREQ : 0);
+	r->fields = (IF >> 9) | (DF >> 12);
+	++h->count;
+}
+
+/* Stop the binary trace of the current machine, if any. Return 0 if done */
+int trace_close(void)
+{
+	TRACEHDR *h = M->trace_hdr;
+	size_t used;
+	int rc;
+
+	if (!h)
+		return 0;
+	trace = 0;
+	used = h->count < h->records ? h->count : h->records;
+	munmap(h, M->trace_size);
+	M->trace_hdr = 0;
+	M->trace_rec = 0;
+
+	/* Drop the part of the ring that was never reached */
+	rc = ftruncate(M->trace_fd, TRACE_DATA + used * sizeof(TRACEREC));
+	close(M->trace_fd);
+	return rc;
+}
+
+/*
+   Trace m to fname, a ring of records instructions (rounded up to a
+   power of 2), or stop if fname is 0. Return 0 if done.
+   A trace that was on is stopped (and its file closed) first.
+*/
+int pdp8_trace(PDP8 *m, const char *fname, unsigned long records)
+{
+	unsigned long long n = 1;
+	size_t size;
+	void *p;
+	int fd, rc;
+
+	M = m;
+	rc = trace_close();
+	if (!fname)
+		return rc;
+
+	while (n < records)
+		n <<= 1;
+	size = TRACE_DATA + n * sizeof(TRACEREC);
+	if ((fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+		return -1;
+	if (ftruncate(fd, size)
+		|| (p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		unlink(fname);
+		return -1;
+	}
+
+	M->trace_hdr = p;
+	M->trace_rec = (TRACEREC *)((char *)p + TRACE_DATA);
+	M->trace_size = size;
+	M->trace_fd = fd;
+	memcpy(M->trace_hdr->magic, TRACE_MAGIC, sizeof(M->trace_hdr->magic));
+	M->trace_hdr->version = TRACE_VERSION;
+	M->trace_hdr->rec_size = sizeof(TRACEREC);
+	M->trace_hdr->records = n;
+	M->trace_hdr->count = 0;
+	trace = 1;
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef	_trace_h
+#define _trace_h
+
+#include <stdint.h>
+
+/*
+   Binary trace file (trace.c, pdp8trace.c)
+
+	TRACEHDR	magic, version, sizes and count
+	TRACEREC	at TRACE_DATA, records of them
+
+   The records are a ring: record i (counting from 0 since the trace
+   started) is at (i & (records - 1)), so when count > records the
+   file holds the last records ones and the oldest is at
+   (count & (records - 1)). Each one is the state right after the
+   instruction at pc was executed, as in a text trace. The format is
+   that of the host.
+*/
+#define	TRACE_MAGIC		"PDP8TRAC"
+#define	TRACE_VERSION	1
+#define	TRACE_DATA		4096	/* Offset of the records */
+
+typedef struct trace_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;		/* sizeof(TRACEREC) */
+	uint64_t records;		/* Room for so many (a power of 2) */
+	uint64_t count;			/* Written so far */
+} TRACEHDR;
+
+#define	TR_LINK		0001	/* L */
+#define	TR_IEN		0002	/* Interrupts enabled */
+#define	TR_IREQ		0004	/* Interrupt requested */
+
+typedef struct trace_rec {
+	uint32_t time;			/* Instructions since power up (low 32 bits) */
+	uint16_t pc;			/* Address of the instruction (15 bits) */
+	uint16_t ir;
+	uint16_t ac, mq, ma;	/* MA is 15 bits */
+	uint8_t flags;			/* TR_xxx */
+	uint8_t fields;			/* IF << 3 | DF */
+} TRACEREC;
+
+#endif	/* _trace_h */
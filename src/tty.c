@@ -1,55 +1,76 @@
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <sys/errno.h>
 
+#include "pdp8.h"
+#include "event.h"
 #include "log.h"
 #include "tty.h"
 
-extern void cpu_ireq(int dev, int updown);
 extern void cpu_stop(void);
 
+// The host terminal
 static struct termios orig_termios;
 static struct termios asr33_termios;
-static char keyb_buffer;
-static int keyb_flag;	// 1 if keyb_buffer has a valid char
-static int tty_flag;	// 1 if teleprinter is done outputing a character
-static int keyb_fd ;	// Keyboard file descriptor
-static int keyb_real;	// 1 if real keyboard, 0 if other file
 
-static int tty_keyb_read(int dev);
-
-static void tty_asr33_mode(int mode);
+// The keyboard and teleprinter of the current machine
+#define	keyb_buffer	(M->st.keyb_buffer)
+#define	keyb_flag	(M->st.keyb_flag)	// 1 if keyb_buffer has a valid char
+#define	tty_flag	(M->st.tty_flag)	// 1 if teleprinter is done outputing a character
+#define	keyb_fd		(M->keyb_fd)	// Keyboard file descriptor (-1=none)
+#define	keyb_real	(M->keyb_real)	// 1 if real keyboard, 0 if other file
+#define	keyb_ring	(M->keyb_ring)	// Input read ahead, keyb_tail..keyb_head
+#define	keyb_head	(M->keyb_head)
+#define	keyb_tail	(M->keyb_tail)
+#define	tty_sync	(M->tty_sync)	// 1 if each character is written at once
+#define	tty_ring	(M->tty_ring)	// Output buffered, tty_tail..tty_head
+#define	tty_head	(M->tty_head)
+#define	tty_tail	(M->tty_tail)
+#define	tty_dev		(M->st.tty_dev)	// Device of the character being printed
+#define	keyb_due	(M->st.keyb_due)	// Time the next key can be made available
+
+#define	KEYB_POLL		1000	// Poll the keyboard every so many instructions
+#define	TTY_FLUSH_DELAY	20000	// Max instructions output stays buffered
+
+// Instructions to print a character and between keys, by dev_rate
+static const unsigned long tty_delay[] = { 0, CPS_DELAY(10), CPS_DELAY(10) };
+
+static int tty_keyb_next(int dev);
+static void tty_keyb_fill(void);
+static void tty_keyb_poll(void);
+static void tty_out_done(void);
+
+static void tty_raw(void);
 
 /*
-	TTY input mode:
-	  0 - Virtual console mode (cooked)
-
-	  1 - Block on read (raw: VMIN=1, VTIME=0)
-		When the simulator detects a loop like
+	Keyboard input
 
-			KSF              / Has a key been pressed?
-	   		JMP      .-1     / No, go back and wait.
+	While a program runs, the terminal is in raw mode, with reads
+	that don't block (VMIN=0, VTIME=0), and stays so
+	until tty_exit() gives it back to the console. Nothing typed
+	ahead is flushed on the way.
 
-		it calls tty_keyb_wait1(), which puts the terminal in
-		mode 1 and waits for a single character. This way the
-		loop is not really executed by the simulator because
-		the idle time is managed by the OS. To the simulator
-		it appears that a character was available the first
-		time KSF was executed.
+	Whatever has been typed is read into keyb_ring by the keyboard
+	poll (an event, every KEYB_POLL instructions) and by
+	tty_keyb_wait(), which sleeps in poll() when the program is idle
+	(see cpu_idle). The program gets it from there one character at
+	a time, so KSF and KRB are memory reads, not syscalls:
 
-	  2 - Don't block on read (raw: VMIN=0, VTIME=0)
-	  	Mode 1 is more efficient but when it cannot be detected
-		the simulator can fall back to these basic calls, which
-		use mode 2 (no wait):
+		tty_keyb_get_flag() (returns 1 if a character is available)
+		tty_keyb_inp1() (returns whatever is in the keyb buffer)
 
-	  3 - Read 0 or 1 character, timeout = 0.5 sec (raw: VMIN=0, VTIME=5)
+	Files assigned to the keyboard are read the same way.
 
-		tty_keyb_getflag() (returns 1 if a character is available)
-		tty_keyb_inp1() (returns whatever is in the keyb buffer)
+	When the device rate is not RATE_MAX, only the poll makes a key
+	available, and no sooner than tty_delay after KRB read the
+	previous one (keyb_due), so the program gets them at 10 cps.
+	The teleprinter takes as long to print a character.
 */
-static int	asr33_mode;
+static int	tty_is_raw;		// The terminal is in raw mode
 
 void tty_init(void)
 {
@@ -63,6 +84,7 @@ void tty_init(void)
 	asr33_termios.c_oflag &= ~(OPOST);
 	asr33_termios.c_cflag |= (CS8);
 	asr33_termios.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	asr33_termios.c_cc[VMIN] = 0;
 	asr33_termios.c_cc[VTIME] = 0;
 
 	keyb_buffer = 0;
@@ -71,35 +93,76 @@ void tty_init(void)
 	keyb_real = 1;	// TODO: check if istty(0)
 }
 
-static void tty_asr33_mode(int mode)
+// A new machine has no keyboard until tty_init() or a callback
+void tty_reset(void)
 {
-	switch (mode) {
-	case 1:	// Read 1 char (blocking, no timeout). VMIN=1, VTIME=0
-		asr33_termios.c_cc[VMIN] = 1;
-		asr33_termios.c_cc[VTIME] = 0;
-		break;
-	case 2:	// Read 0 or 1 char (non-blocking). VMIN=0, VTIME=0
-		asr33_termios.c_cc[VMIN] = 0;
-		asr33_termios.c_cc[VTIME] = 0;
-		break;
-	case 3:	// Read 0 or 1 char (blocking, timeout = 0.5 sec), VMIN=0, VTIME=5
-		asr33_termios.c_cc[VMIN] = 0;
-		asr33_termios.c_cc[VTIME] = 5;
-		break;
-	}
-	if (tcsetattr(0, TCSAFLUSH, &asr33_termios) == -1)
-		log_error(errno, "tcsetattr");
+	keyb_fd = -1;
+	keyb_real = 0;
+	ev_handler(EV_TTY_IN, tty_keyb_poll);
+	ev_handler(EV_TTY_OUT, tty_out_done);
+	ev_handler(EV_TTY_FLUSH, tty_flush);
+	tty_sync = isatty(1);
+	tty_out_set_flag(4, 1);	// Ready to print
+}
 
-	asr33_mode = mode;
+// Put the terminal in raw mode, if it is one
+static void tty_raw(void)
+{
+	if (tty_is_raw || !isatty(0))
+		return;
+	if (tcsetattr(0, TCSANOW, &asr33_termios) == -1)
+		log_error(errno, "tcsetattr");
+	tty_is_raw = 1;
 }
 
 void tty_exit(void)
 {
-	if (keyb_real && asr33_mode) {
-		if (tcsetattr(0, TCSAFLUSH, &orig_termios) == -1)
+	if (tty_is_raw) {
+		if (tcsetattr(0, TCSANOW, &orig_termios) == -1)
 			log_error(errno, "tcsetattr");
 
-		asr33_mode = 0;
+		tty_is_raw = 0;
+	}
+}
+
+/*
+	Teleprinter output
+
+	When stdout is a terminal, each character is written as soon as
+	it is printed, so that an interactive program behaves like on a
+	real teleprinter. Otherwise the output is buffered in tty_ring
+	and written by tty_flush() at the end of a line, when the ring
+	is full, when the program is idle or stops, and at the latest
+	TTY_FLUSH_DELAY instructions after it was printed (an event).
+*/
+void tty_flush(void)
+{
+	struct iovec iov[2];
+	unsigned t = tty_tail & (TTY_RING - 1);
+	unsigned n = tty_head - tty_tail;
+	int iovcnt = 1;
+	ssize_t rc;
+
+	ev_cancel(EV_TTY_FLUSH);
+	while (n) {
+		iov[0].iov_base = &tty_ring[t];
+		iov[0].iov_len = n;
+		if (t + n > TTY_RING) {		// Wraps around
+			iov[0].iov_len = TTY_RING - t;
+			iov[1].iov_base = tty_ring;
+			iov[1].iov_len = n - iov[0].iov_len;
+			iovcnt = 2;
+		}
+		if ((rc = writev(1, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error(errno, "writev");
+			rc = n;		// Drop it
+		}
+		tty_tail += rc;
+		t = tty_tail & (TTY_RING - 1);
+		n -= rc;
+		iovcnt = 1;
 	}
 }
 
@@ -143,9 +206,28 @@ void tty_out1(int dev, int chr)
 #else
 	buf = chr;
 #endif
-	write(1, &buf, 1);
+	if (M->rev && rev_quiet())
+		;							// Printed already (see rev.c)
+	else if (M->tty_fn)
+		(*M->tty_fn)(M->tty_ctx, buf);
+	else if (tty_sync)
+		write(1, &buf, 1);
+	else {
+		tty_ring[tty_head++ & (TTY_RING - 1)] = buf;
+		if (buf == '\n' || tty_head - tty_tail == TTY_RING)
+			tty_flush();
+		else if (!ev_pending(EV_TTY_FLUSH))
+			ev_schedule(EV_TTY_FLUSH, TTY_FLUSH_DELAY);
+	}
+	tty_dev = dev;
+	ev_schedule(EV_TTY_OUT, tty_delay[dev_rate]);
+}
+
+// The character has been printed (event)
+static void tty_out_done(void)
+{
 	tty_flag = 1;
-	cpu_ireq(dev, 1);	// Request interrupt
+	cpu_ireq(tty_dev, 1);	// Request interrupt
 }
 
 // Set teleprinter flag to 0/1
@@ -177,31 +259,63 @@ void tty_keyb_assign(char* fname)
 
 	keyb_fd = fd;
 	keyb_real = 0;
-	tty_keyb_read(3);	// First character
+	keyb_head = keyb_tail = 0;	// Nothing from the previous one
+	tty_keyb_fill();
+	if (!keyb_flag)
+		tty_keyb_next(3);	// First character
 }
 
-// Wait for 1 character to be pressed
-int tty_keyb_wait1(int dev)
+// Poll the keyboard (event)
+static void tty_keyb_poll(void)
 {
-	if (keyb_flag) return 1;
-	if (keyb_real && asr33_mode != 1) tty_asr33_mode(1);
-	return tty_keyb_read(dev);
+	unsigned long long now = cpu_time();
+
+	tty_keyb_fill();
+	if (now < keyb_due) {	// Too soon after the previous key
+		ev_schedule(EV_TTY_IN, keyb_due - now);
+		return;
+	}
+	if (!keyb_flag)
+		tty_keyb_next(3);
+	tty_keyb_schedule();
+}
+
+// Schedule the next keyboard poll KEYB_POLL instructions from now
+void tty_keyb_schedule(void)
+{
+	ev_schedule(EV_TTY_IN, KEYB_POLL);
 }
 
 // Get keyboard flag (no-wait)
 int tty_keyb_get_flag(int dev)
 {
-	if (keyb_flag) return 1;
-	if (keyb_real && asr33_mode != 2) tty_asr33_mode(2);
-	return tty_keyb_read(dev);
+	if (keyb_flag || dev_rate != RATE_MAX)	// Throttled: only the poll
+		return keyb_flag;
+	return tty_keyb_next(dev);
 }
 
-// Wait for 1 character to be pressed, 0.5s timeout
-int tty_keyb_timed_wait1(int dev)
+// Return 1 if a key waits for the poll to make it available
+int tty_keyb_ahead(void)
 {
-	if (keyb_flag) return 1;
-	if (keyb_real && asr33_mode != 3) tty_asr33_mode(3);
-	return tty_keyb_read(dev);
+	return !keyb_flag && keyb_head != keyb_tail;
+}
+
+// Wait up to ms milliseconds (-1=forever) for a key to be pressed
+// Return 1 if one was, 0 if not, -1 if the keyboard is not a terminal
+int tty_keyb_wait(int ms)
+{
+	struct pollfd pfd;
+	unsigned n = keyb_head;
+
+	if (M->keyb_fn || !keyb_real || !isatty(keyb_fd))
+		return -1;
+	tty_raw();
+
+	pfd.fd = keyb_head - keyb_tail < KEYB_RING ? keyb_fd : -1;	// Full?
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, ms) > 0)
+		tty_keyb_fill();
+	return keyb_head != n;
 }
 
 // Set keyboard flag to 0/1
@@ -221,35 +335,73 @@ int tty_keyb_inp1(int dev)
 	if (keyb_flag) {
 		keyb_flag = 0;
 		cpu_ireq(dev, 0);	// Clear interrupt request
+		keyb_due = cpu_time() + tty_delay[dev_rate];
 		return keyb_buffer | 0200;
 	}
-	if (keyb_real && asr33_mode != 2) tty_asr33_mode(2);
-	return tty_keyb_read(dev);
+	if (dev_rate != RATE_MAX)
+		return keyb_buffer | 0200;
+	return tty_keyb_next(dev);
 }
 
-// Low level read 1 character
-static int tty_keyb_read(int dev)
+// Read whatever the keyboard has into keyb_ring (no wait)
+static void tty_keyb_fill(void)
 {
-	int rc;
+	unsigned char buf[KEYB_RING];
+	unsigned space = KEYB_RING - (keyb_head - keyb_tail);
+	ssize_t rc;
+	ssize_t i;
 
-	if ((rc = read(keyb_fd, &keyb_buffer, 1)) == 1) {
-		keyb_flag = 1;
-		if (keyb_buffer == CTRL_C)
-			cpu_stop();
-		if (keyb_buffer == 10)
-			keyb_buffer = 13;	// \n --> \r
+	if (M->keyb_fn || keyb_fd < 0 || !space)
+		return;
+	if (keyb_real)
+		tty_raw();
+
+	rc = read(keyb_fd, buf, space);
+	if (rc > 0) {
+		for (i = 0; i < rc; ++i) {
+			if (keyb_real && buf[i] == CTRL_C)
+				cpu_stop();		// Now, not when the program reads it
+			keyb_ring[keyb_head++ & (KEYB_RING - 1)] = buf[i];
+		}
 	} else if (rc == 0) {		// EOF
-		keyb_flag = 0;
 		if (keyb_fd) {			// If not stdin, close and reassign to 0
 			close(keyb_fd);
 			keyb_fd = 0;
 			keyb_real = 1;
 		}
 	} else {					// Possibly error
-		keyb_flag = 0;
 		if (errno != EAGAIN)	// EWOULDBLOCK?
 			log_error(errno, "read");
 	}
+}
+
+// Make the next character available, if any
+static int tty_keyb_next(int dev)
+{
+	int ch;
+
+	if (M->rev && (ch = rev_input(REV_KEYB)) != REV_LIVE)
+		;							// Typed already (see rev.c)
+	else {
+		if (M->keyb_fn)				// Callback, -1 if nothing yet
+			ch = (*M->keyb_fn)(M->keyb_ctx);
+		else if (keyb_head != keyb_tail)
+			ch = keyb_ring[keyb_tail++ & (KEYB_RING - 1)];
+		else
+			ch = -1;
+		if (M->rev && ch >= 0)
+			rev_record(REV_KEYB, ch);
+	}
+
+	if (ch >= 0) {
+		keyb_buffer = ch;
+		keyb_flag = 1;
+		if (!keyb_real && keyb_buffer == CTRL_C)
+			cpu_stop();
+		if (keyb_buffer == 10)
+			keyb_buffer = 13;	// \n --> \r
+	} else
+		keyb_flag = 0;
 
 	cpu_ireq(dev, keyb_flag);
 	return keyb_flag;
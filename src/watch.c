@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdp8.h"
+
+/*
+   Watchpoints
+
+   A watchpoint stops the CPU, or only reports through on_watch, when
+   a range of words is read or written. The words watched are tagged
+   T_WATCHR/T_WATCHW in MT[], like those with a breakpoint, and while
+   there are any watchpoints cpu_attention() is called after every
+   instruction and calls watch_check():
+
+	Writes are caught by the tag in MEM_STORE, which every store
+	goes through (DCA, ISZ, JMS, auto-index, interrupts, devices):
+	cpu_store_tagged() calls watch_store(), which keeps the
+	address for watch_check().
+	Reads are those of the instruction just executed (THISPC, IR,
+	MA): its indirect pointer and the operand of AND, TAD and ISZ.
+
+   With no watchpoints, nothing is checked, and the stores only test
+   MT[] as they always do.
+
+   Watchpoint n (from 1, as long as it is set) is watch_table[n - 1].
+*/
+#define	watch_table	(M->watch_table)
+#define	watch_slots	(M->watch_slots)
+
+#define	WATCH_SLOTS	16	/* Initial size of watch_table */
+
+/* Tag the words of w according to all the watchpoints set */
+static void watch_tag(const WATCH *w)
+{
+	const WATCH *o;
+	WORD a;
+	int n;
+
+	for (a = w->addr; a < w->addr + w->len; ++a)
+		MT[a] &= ~T_WATCH;
+	for (n = 0, o = watch_table; n < watch_slots; ++n, ++o) {
+		if (!o->used || o->addr >= w->addr + w->len || o->addr + o->len <= w->addr)
+			continue;
+		for (a = o->addr; a < o->addr + o->len; ++a) {
+			if (a < w->addr || a >= w->addr + w->len)
+				continue;
+			if (o->mode & WATCH_R)
+				MT[a] |= T_WATCHR;
+			if (o->mode & WATCH_W)
+				MT[a] |= T_WATCHW;
+		}
+	}
+}
+
+/* Set watchpoint *w (its hits are cleared). Return its number, 0 if out of memory */
+int watch_set(const WATCH *w)
+{
+	WATCH *t;
+	int n, slots;
+
+	for (n = 0; n < watch_slots && watch_table[n].used; ++n)
+		;
+	if (n == watch_slots) {	/* Full */
+		slots = watch_slots ? 2 * watch_slots : WATCH_SLOTS;
+		if (!(t = realloc(watch_table, slots * sizeof(WATCH))))
+			return 0;
+		memset(t + watch_slots, 0, (slots - watch_slots) * sizeof(WATCH));
+		watch_table = t;
+		watch_slots = slots;
+	}
+
+	watch_table[n] = *w;
+	watch_table[n].used = 1;
+	watch_table[n].hits = 0;
+	if (watch_table[n].addr + watch_table[n].len > memwords)
+		watch_table[n].len = memwords - watch_table[n].addr;
+	watch_tag(&watch_table[n]);
+	++WATCH_COUNT;
+	return n + 1;
+}
+
+/* Return watchpoint n, or 0 if it isn't set */
+WATCH *watch_get(int n)
+{
+	if (n < 1 || n > watch_slots || !watch_table[n - 1].used)
+		return 0;
+	return &watch_table[n - 1];
+}
+
+/* Clear watchpoint n. Return 0 if done, -1 if it isn't set */
+int watch_clear(int n)
+{
+	WATCH *w;
+
+	if (!(w = watch_get(n)))
+		return -1;
+	w->used = 0;
+	--WATCH_COUNT;
+	watch_tag(w);	/* What the others still watch */
+	return 0;
+}
+
+/* Called by cpu_store_tagged(): addr (tagged T_WATCHW) was stored into */
+void watch_store(WORD addr)
+{
+	if (RUN && M->watch_stores < WATCH_STORES)
+		M->watch_store[M->watch_stores++] = addr;
+}
+
+/*
+   An access to addr. Count a hit for each watchpoint on it and report
+   it. Return the number of the first one to stop at, else stop.
+*/
+static int watch_hit(WORD addr, int mode, int stop)
+{
+	WATCH *w;
+	int n;
+
+	for (n = 1, w = watch_table; n <= watch_slots; ++n, ++w) {
+		if (!w->used || !(w->mode & mode) || addr < w->addr || addr >= w->addr + w->len)
+			continue;
+		++w->hits;
+		if (w->mode & WATCH_LOG) {
+			if (M->on_watch)
+				(*M->on_watch)(n, addr, mode == WATCH_W);
+		} else if (!stop) {
+			stop = n;
+			M->watch_addr = addr;
+			M->watch_write = mode == WATCH_W;
+		}
+	}
+	return stop;
+}
+
+/*
+   Called after each instruction while there are watchpoints. Report
+   the accesses to the words watched and return the number of the
+   first watchpoint to stop at, 0 to go on.
+*/
+int watch_check(void)
+{
+	WORD ptr, op = IR >> 9;
+	int i, stop = 0;
+
+	if (op < 6 && (IR & INDIR_BIT)) {	/* Indirect pointer */
+		ptr = (THISPC & FIELD_MASK) | (IR & OFF_MASK);
+		if (IR & PAGE_BIT)
+			ptr |= THISPC & PAGE_MASK;
+		if (MT[ptr] & T_WATCHR)
+			stop = watch_hit(ptr, WATCH_R, stop);
+	}
+	if (op < 3 && (MT[MA] & T_WATCHR))	/* AND, TAD, ISZ operand */
+		stop = watch_hit(MA, WATCH_R, stop);
+
+	for (i = 0; i < M->watch_stores; ++i)
+		stop = watch_hit(M->watch_store[i], WATCH_W, stop);
+	M->watch_stores = 0;
+	return stop;
+}